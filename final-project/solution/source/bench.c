@@ -0,0 +1,420 @@
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "utils.h"
+#include "stats.h"
+
+/**
+ * bench.c
+ * load generator for the server. -c threads run closed loops of
+ * connect, query, read the whole response, close; until -n queries are
+ * done. queries are drawn from a mix (uniform pairs, zipf skewed pairs or a
+ * trace file) and throughput, latency percentiles and the cache hit rate of
+ * the server (from its stats query) are reported at the end.
+ **/
+
+#define MAX_BYTE 1024
+#define MIX_UNIFORM 0
+#define MIX_ZIPF 1
+#define MIX_TRACE 2
+
+struct BenchArgs
+{
+    char host_addr[32];
+    int port, concurrency, requests, vertices, unique, mix;
+    double zipf_s;
+    unsigned int seed;
+    unsigned int timeout_ms; // of every query, 0 for none.
+    char *trace;
+};
+
+struct Pair
+{
+    unsigned int src, dest;
+};
+
+struct BenchArgs args;
+struct sockaddr_in host_addr;
+
+struct Pair *pairs = NULL; // zipf: distinct pairs by rank, trace: the file in order.
+int pair_count = 0;
+double *zipf_cdf = NULL;
+
+atomic_int issued;
+atomic_long unreachable, errors, busy, timeouts;
+struct Histogram latency;  // of answered queries only.
+struct Histogram refusals; // of BUSY_REPLY and TIMEOUT_REPLY, quick under saturation.
+
+void bench_parse_args(int argc, char **argv);
+void bench_help();
+void check_arg(int flag, char arg);
+
+/* connects and sends one query, returns the socket or -1. */
+int send_query(unsigned int type, unsigned int src, unsigned int dest)
+{
+    int sockfd;
+    if ((sockfd = socket(AF_INET, SOCK_STREAM, 0)) == -1)
+        return -1;
+    if (connect(sockfd, (struct sockaddr *)&host_addr, sizeof(host_addr)) != 0)
+    {
+        close(sockfd);
+        return -1;
+    }
+    struct Packet packet = {type, src, dest, type == QUERY_STATS ? 0 : args.timeout_ms};
+    if (write(sockfd, &packet, sizeof(struct Packet)) != sizeof(struct Packet))
+    {
+        close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+/* reads the response until the server closes, keeps the first MAX_BYTE - 1 bytes. */
+int read_response(int sockfd, char *buf)
+{
+    int total = 0, read_byte;
+    char chunk[MAX_BYTE];
+    while ((read_byte = read(sockfd, chunk, MAX_BYTE)) > 0)
+    {
+        int keep = read_byte < MAX_BYTE - 1 - total ? read_byte : MAX_BYTE - 1 - total;
+        memcpy(buf + total, chunk, keep);
+        total += keep;
+    }
+    buf[total] = '\0';
+    return read_byte == 0 ? total : -1;
+}
+
+/* value of a "name value" line in the server's stats, -1 if it is missing. */
+long stat_value(char *stats, const char *name)
+{
+    char *line = stats;
+    int len = strlen(name);
+    while (line != NULL && *line != '\0')
+    {
+        if (strncmp(line, name, len) == 0 && line[len] == ' ')
+            return strtol(line + len + 1, NULL, 10);
+        if ((line = strchr(line, '\n')) != NULL)
+            line++;
+    }
+    return -1;
+}
+
+int fetch_stats(long *hits, long *misses)
+{
+    char buf[MAX_BYTE * 4];
+    int sockfd = send_query(QUERY_STATS, 0, 0);
+    if (sockfd == -1)
+        return FALSE;
+
+    int total = 0, read_byte;
+    while ((read_byte = read(sockfd, buf + total, sizeof(buf) - 1 - total)) > 0)
+        total += read_byte;
+    buf[total] = '\0';
+    close(sockfd);
+
+    *hits = stat_value(buf, "hits");
+    *misses = stat_value(buf, "misses");
+    return *hits != -1 && *misses != -1;
+}
+
+struct Pair random_pair(unsigned int *seed)
+{
+    struct Pair p = {rand_r(seed) % args.vertices, rand_r(seed) % args.vertices};
+    return p;
+}
+
+/* rank of the next pair, P(rank k) is proportional to 1 / (k + 1)^s. */
+int zipf_rank(unsigned int *seed)
+{
+    double u = rand_r(seed) / ((double)RAND_MAX + 1);
+    int lo = 0, hi = pair_count - 1;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (zipf_cdf[mid] < u)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+struct Pair next_pair(int n, unsigned int *seed)
+{
+    switch (args.mix)
+    {
+    case MIX_ZIPF:
+        return pairs[zipf_rank(seed)];
+    case MIX_TRACE:
+        return pairs[n % pair_count];
+    default:
+        return random_pair(seed);
+    }
+}
+
+void *bench_worker(void *p)
+{
+    unsigned int seed = args.seed + *(int *)p;
+    char response[MAX_BYTE];
+
+    int n;
+    while ((n = atomic_fetch_add(&issued, 1)) < args.requests)
+    {
+        struct Pair pair = next_pair(n, &seed);
+        long start = monotonic_us();
+        int sockfd = send_query(QUERY_PATH, pair.src, pair.dest);
+        if (sockfd == -1 || read_response(sockfd, response) <= 0)
+            atomic_fetch_add(&errors, 1);
+        else
+        {
+            int refused = strcmp(response, BUSY_REPLY) == 0, expired = strcmp(response, TIMEOUT_REPLY) == 0;
+            hist_record(refused || expired ? &refusals : &latency, monotonic_us() - start);
+            if (refused)
+                atomic_fetch_add(&busy, 1);
+            else if (expired)
+                atomic_fetch_add(&timeouts, 1);
+            else if (strncmp(response, "path not possible", 17) == 0)
+                atomic_fetch_add(&unreachable, 1);
+        }
+        if (sockfd != -1)
+            close(sockfd);
+    }
+    return NULL;
+}
+
+void load_trace()
+{
+    FILE *fp = fopen(args.trace, "r");
+    if (fp == NULL)
+        xerror(__func__, "fopen trace file");
+
+    int cap = 1024;
+    pairs = xmalloc(cap * sizeof(struct Pair));
+    char line[256];
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        struct Pair p;
+        if (line[0] == '#' || sscanf(line, "%u %u", &p.src, &p.dest) != 2)
+            continue;
+        if (pair_count == cap)
+            pairs = xrealloc(pairs, (cap *= 2) * sizeof(struct Pair));
+        pairs[pair_count++] = p;
+    }
+    fclose(fp);
+    if (pair_count == 0)
+        xerror(__func__, "no pairs in trace file");
+}
+
+void build_zipf()
+{
+    unsigned int seed = args.seed;
+    pair_count = args.unique;
+    pairs = xmalloc(pair_count * sizeof(struct Pair));
+    zipf_cdf = xmalloc(pair_count * sizeof(double));
+
+    double sum = 0;
+    for (int k = 0; k < pair_count; k++)
+    {
+        pairs[k] = random_pair(&seed);
+        sum += 1 / pow(k + 1, args.zipf_s);
+        zipf_cdf[k] = sum;
+    }
+    for (int k = 0; k < pair_count; k++)
+        zipf_cdf[k] /= sum;
+}
+
+int main(int argc, char *argv[])
+{
+    bench_parse_args(argc, argv);
+
+    bzero(&host_addr, sizeof(struct sockaddr_in));
+    host_addr.sin_family = AF_INET;
+    host_addr.sin_addr.s_addr = inet_addr(args.host_addr);
+    host_addr.sin_port = htons(args.port);
+
+    if (args.mix == MIX_TRACE)
+        load_trace();
+    else if (args.mix == MIX_ZIPF)
+        build_zipf();
+
+    init_histogram(&latency);
+    init_histogram(&refusals);
+    atomic_init(&issued, 0);
+    atomic_init(&unreachable, 0);
+    atomic_init(&errors, 0);
+    atomic_init(&busy, 0);
+    atomic_init(&timeouts, 0);
+
+    long hits_before = 0, misses_before = 0, hits_after = 0, misses_after = 0;
+    int have_stats = fetch_stats(&hits_before, &misses_before);
+
+    pthread_t *threads = xmalloc(args.concurrency * sizeof(pthread_t));
+    int *ids = xmalloc(args.concurrency * sizeof(int));
+    long start = monotonic_us();
+    for (int i = 0; i < args.concurrency; i++)
+    {
+        ids[i] = i;
+        xthread_create(&threads[i], bench_worker, &ids[i]);
+    }
+    for (int i = 0; i < args.concurrency; i++)
+        xthread_join(threads[i]);
+    double elapsed = (monotonic_us() - start) / 1000000.0;
+
+    have_stats = have_stats && fetch_stats(&hits_after, &misses_after);
+
+    long done = atomic_load(&latency.total), refused = atomic_load(&refusals.total);
+    printf("queries %ld, errors %ld, unreachable %ld, busy %ld, timeouts %ld, concurrency %d, %.3f seconds\n",
+           done + refused, atomic_load(&errors), atomic_load(&unreachable), atomic_load(&busy), atomic_load(&timeouts),
+           args.concurrency, elapsed);
+    printf("throughput %.1f queries/s\n", done / elapsed);
+    printf("latency_us mean %ld p50 %ld p90 %ld p99 %ld p999 %ld max %ld\n",
+           done ? atomic_load(&latency.sum) / done : 0, hist_percentile(&latency, 50),
+           hist_percentile(&latency, 90), hist_percentile(&latency, 99),
+           hist_percentile(&latency, 99.9), atomic_load(&latency.max));
+    if (refused > 0) // apart, quick refusals would make service look faster than it is.
+        printf("refused_us mean %ld p50 %ld p99 %ld max %ld\n", atomic_load(&refusals.sum) / refused,
+               hist_percentile(&refusals, 50), hist_percentile(&refusals, 99), atomic_load(&refusals.max));
+    if (have_stats && hits_after + misses_after > hits_before + misses_before)
+        printf("cache hit rate %.1f%%\n", 100.0 * (hits_after - hits_before) /
+                                              (hits_after + misses_after - hits_before - misses_before));
+    else
+        printf("cache hit rate unavailable\n");
+
+    free(threads);
+    free(ids);
+    free(pairs);
+    free(zipf_cdf);
+    return atomic_load(&errors) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+void bench_parse_args(int argc, char **argv)
+{
+    int aflag = FALSE, pflag = FALSE, vflag = FALSE;
+    args.concurrency = 8;
+    args.requests = 10000;
+    args.unique = 10000;
+    args.mix = MIX_UNIFORM;
+    args.zipf_s = 1.0;
+    args.seed = 1;
+    args.trace = NULL;
+    args.timeout_ms = 0;
+
+    char opt;
+    while ((opt = getopt(argc, argv, "a:p:c:n:m:V:u:z:f:r:t:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'a':
+            aflag = TRUE;
+            strncpy(args.host_addr, optarg, sizeof(args.host_addr) - 1);
+            args.host_addr[sizeof(args.host_addr) - 1] = '\0';
+            break;
+        case 'p':
+            args.port = str_to_int(optarg);
+            pflag = TRUE;
+            if (args.port < 0 || args.port > 65535)
+            {
+                fprintf(stderr, "Port arg, is not in range [0, 65535].");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'c':
+            if ((args.concurrency = str_to_int(optarg)) < 1)
+            {
+                fprintf(stderr, "Concurrency (c) arg, is not in range [1, +inf].");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'n':
+            if ((args.requests = str_to_int(optarg)) < 1)
+            {
+                fprintf(stderr, "Number of queries (n) arg, is not in range [1, +inf].");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'm':
+            if (strcmp(optarg, "uniform") == 0)
+                args.mix = MIX_UNIFORM;
+            else if (strcmp(optarg, "zipf") == 0)
+                args.mix = MIX_ZIPF;
+            else if (strcmp(optarg, "trace") == 0)
+                args.mix = MIX_TRACE;
+            else
+            {
+                fprintf(stderr, "Query mix (m) arg, is not one of uniform, zipf, trace.");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'V':
+            vflag = TRUE;
+            if ((args.vertices = str_to_int(optarg)) < 1)
+            {
+                fprintf(stderr, "Vertex count (V) arg, is not in range [1, +inf].");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'u':
+            if ((args.unique = str_to_int(optarg)) < 1)
+            {
+                fprintf(stderr, "Distinct pairs (u) arg, is not in range [1, +inf].");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'z':
+            if ((args.zipf_s = strtod(optarg, NULL)) <= 0)
+            {
+                fprintf(stderr, "Zipf exponent (z) arg, is not in range (0, +inf).");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'f':
+            args.trace = optarg;
+            break;
+        case 'r':
+            args.seed = str_to_int(optarg);
+            break;
+        case 't':
+            if (str_to_int(optarg) < 0)
+            {
+                fprintf(stderr, "Timeout (t) arg, is not in range [0, MAX_INT].");
+                exit(EXIT_FAILURE);
+            }
+            args.timeout_ms = str_to_int(optarg);
+            break;
+        case '?':
+        default:
+            bench_help();
+            exit(EXIT_SUCCESS);
+            break;
+        }
+    }
+    check_arg(aflag, 'a');
+    check_arg(pflag, 'p');
+    if (args.mix == MIX_TRACE)
+        check_arg(args.trace != NULL, 'f');
+    else
+        check_arg(vflag, 'V');
+}
+
+void bench_help()
+{
+    printf("Usage: ./bench -a <server_address> -p <port> -V <vertices> [-c <connections>] [-n <queries>]\n"
+           "               [-m uniform|zipf|trace] [-u <distinct_pairs>] [-z <zipf_exponent>] [-f <trace_file>] [-r <seed>]\n"
+           "               [-t <timeout_ms>]\n"
+           "Example: $./bench -a 127.0.0.1 -p PORT -V 6301 -c 16 -n 20000 -m zipf\n"
+           "\t-V:\t\tqueries use node ids in [0, V)\n"
+           "\t-c:\t\tconcurrent connections, 8 by default\n"
+           "\t-n:\t\tnumber of queries, 10000 by default\n"
+           "\t-m:\t\tuniform random pairs (default), zipf skewed over -u distinct pairs,\n"
+           "\t\t\tor the \"src dest\" lines of the -f trace file in order\n"
+           "\t-z:\t\tzipf exponent, 1.0 by default\n"
+           "\t-t:\t\tmilliseconds the server may spend on a query, none by default\n"
+           "\t--help:\t\tdisplay what you are reading now\n\n"
+           "Exit status:\n"
+           "0\tif OK,\n"
+           "1\tif some queries failed.\n\n\n");
+}
@@ -0,0 +1,351 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include "utils.h"
+#include "graph.h"
+#include "landmark.h"
+#include "order.h"
+#include "compressed.h"
+#include "parallel.h"
+#include "dijkstra.h"
+
+/**
+ * bfsbench.c
+ * offline benchmark of graph.h, no daemon involved. loads an edge list,
+ * times graph construction and edge() lookups, then runs the same random
+ * source/target queries through every selected BFS variant and prints the
+ * time and the vertices/edges visited of each query, plus a summary.
+ * hop counts of the BFS variants are cross checked against the first one,
+ * path costs of the Dijkstra variants against the first of those.
+ **/
+
+#define VARIANT_PATHS 0
+#define VARIANT_PARENT 1
+#define VARIANT_BIDIR 2
+#define VARIANT_ALT 3
+#define VARIANT_VARINT 4
+#define VARIANT_BITMAP 5
+#define VARIANT_PARALLEL 6
+#define VARIANT_DIJKSTRA 7 // this one and the next ones minimize the cost, not the hops.
+#define VARIANT_BIDIJKSTRA 8
+#define VARIANT_COUNT 9
+
+struct BfsBenchArgs
+{
+    char *input;
+    int queries, lookups, quiet, landmarks, order, helpers;
+    unsigned int seed;
+    int variants[VARIANT_COUNT]; // run order, -1 terminated.
+};
+
+const char *variant_names[VARIANT_COUNT] = {"paths", "parent", "bidir", "alt", "varint", "bitmap", "parallel",
+                                           "dijkstra", "bidijkstra"};
+
+struct BfsBenchArgs args;
+struct Graph *graph, *reverse = NULL;
+struct LandmarkIndex *landmarks = NULL;
+struct CompressedGraph *compressed = NULL;
+struct BfsTeam *team = NULL;
+
+void bfsbench_parse_args(int argc, char **argv);
+void bfsbench_help();
+void check_arg(int flag, char arg);
+
+struct Queue *run_variant(int variant, int start, int end, long *cost, struct SearchStats *stats)
+{
+    switch (variant)
+    {
+    case VARIANT_DIJKSTRA:
+        return dijkstra(graph, start, end, cost, stats);
+    case VARIANT_BIDIJKSTRA:
+        return dijkstra_bidirectional(graph, reverse, start, end, cost, stats);
+    case VARIANT_PARENT:
+        return bfs_parent(graph, start, end, stats);
+    case VARIANT_BIDIR:
+        return bfs_bidirectional(graph, reverse, start, end, stats);
+    case VARIANT_ALT:
+        return landmark_search(graph, reverse, landmarks, start, end, stats);
+    case VARIANT_VARINT:
+        return bfs_compressed(compressed, start, end, stats);
+    case VARIANT_BITMAP:
+        return bfs_bitmap(graph, start, end, stats);
+    case VARIANT_PARALLEL:
+        return bfs_parallel(team, graph, start, end, stats);
+    default:
+        return bfs_paths(graph, start, end, stats);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    bfsbench_parse_args(argc, argv);
+
+    int edge_count;
+    long start = monotonic_us();
+    if ((graph = load_graph(xopen(args.input, O_RDONLY), &edge_count)) == NULL)
+    {
+        fprintf(stderr, "cannot load %s, line %d is malformed (0: the file as a whole)\n", args.input, edge_count);
+        exit(EXIT_FAILURE);
+    }
+    printf("graph loaded in %.3f ms with %d nodes and %d edges%s\n",
+           (monotonic_us() - start) / 1000.0, graph->V, edge_count, graph->weighted ? ", weighted" : "");
+
+    if (args.order != ORDER_NONE)
+    {
+        start = monotonic_us();
+        struct Adjacency linked = linked_adjacency(graph);
+        double span = edge_span(&linked);
+        int *sequence = vertex_order(&linked, args.order);
+        int *perm = invert_order(sequence, graph->V);
+        struct Graph *relabeled = relabel_graph(graph, sequence, perm);
+        destroy_graph(graph);
+        free(graph);
+        free(sequence);
+        free(perm);
+        graph = relabeled;
+        linked = linked_adjacency(graph);
+        printf("graph reordered in %.3f ms, mean edge span %.1f -> %.1f\n",
+               (monotonic_us() - start) / 1000.0, span, edge_span(&linked));
+    }
+
+    for (int k = 0; k < VARIANT_COUNT && args.variants[k] != -1; k++)
+        if ((args.variants[k] == VARIANT_BIDIR || args.variants[k] == VARIANT_ALT ||
+             args.variants[k] == VARIANT_BIDIJKSTRA) && reverse == NULL)
+        {
+            start = monotonic_us();
+            reverse = reverse_graph(graph);
+            printf("reverse graph built in %.3f ms\n", (monotonic_us() - start) / 1000.0);
+        }
+    for (int k = 0; k < VARIANT_COUNT && args.variants[k] != -1; k++)
+        if (args.variants[k] == VARIANT_ALT)
+        {
+            start = monotonic_us();
+            struct Adjacency linked = linked_adjacency(graph), linked_reverse = linked_adjacency(reverse);
+            landmarks = build_landmark_index(&linked, &linked_reverse, args.landmarks);
+            printf("landmark index built in %.3f ms with %d landmarks, %ld bytes\n",
+                   (monotonic_us() - start) / 1000.0, landmarks->k, landmark_bytes(landmarks));
+        }
+        else if (args.variants[k] == VARIANT_PARALLEL)
+            team = create_bfs_team(args.helpers);
+        else if (args.variants[k] == VARIANT_VARINT)
+        {
+            start = monotonic_us();
+            compressed = compress_graph(graph);
+            printf("graph compressed in %.3f ms, adjacency %ld -> %ld bytes\n", (monotonic_us() - start) / 1000.0,
+                   sizeof(struct AdjacencyNode) * compressed->edges + sizeof(struct AdjacencyNode *) * (long)graph->V,
+                   compressed_bytes(compressed));
+        }
+
+    unsigned int seed = args.seed;
+    int found = 0;
+    start = monotonic_us();
+    for (int k = 0; k < args.lookups; k++)
+        found += edge(graph, rand_r(&seed) % graph->V, rand_r(&seed) % graph->V);
+    printf("%d edge() lookups in %.3f ms, %d hits\n", args.lookups, (monotonic_us() - start) / 1000.0, found);
+
+    int *sources = xmalloc(sizeof(int) * args.queries);
+    int *targets = xmalloc(sizeof(int) * args.queries);
+    int *hops = xmalloc(sizeof(int) * args.queries);
+    long *costs = xmalloc(sizeof(long) * args.queries);
+    for (int q = 0; q < args.queries; q++)
+    {
+        sources[q] = rand_r(&seed) % graph->V;
+        targets[q] = rand_r(&seed) % graph->V;
+    }
+
+    if (!args.quiet)
+        printf("variant\tsource\ttarget\thops\tcost\ttime_us\tvertices\tedges\n");
+    int first_bfs = -1, first_dijkstra = -1; // reference variant of each kind.
+    for (int k = 0; k < VARIANT_COUNT && args.variants[k] != -1; k++)
+    {
+        int variant = args.variants[k];
+        int weighted = variant >= VARIANT_DIJKSTRA;
+        int *first = weighted ? &first_dijkstra : &first_bfs, reference = *first == -1;
+        if (reference)
+            *first = variant;
+        long total_us = 0, max_us = 0, vertices = 0, edges = 0;
+        int reachable = 0, mismatches = 0;
+        for (int q = 0; q < args.queries; q++)
+        {
+            struct SearchStats stats = {0, 0, 0, -1, FALSE};
+            start = monotonic_us();
+            long cost = -1;
+            struct Queue *path = run_variant(variant, sources[q], targets[q], &cost, &stats);
+            long elapsed = monotonic_us() - start;
+
+            int h = path == NULL ? -1 : size(path) - 1;
+            if (path == NULL)
+                cost = -1;
+            if (path != NULL)
+            {
+                reachable++;
+                destroy_queue(path);
+                free(path);
+            }
+            if (reference && weighted)
+                costs[q] = cost;
+            else if (reference)
+                hops[q] = h;
+            else if (weighted ? costs[q] != cost : hops[q] != h)
+                mismatches++;
+
+            total_us += elapsed;
+            max_us = elapsed > max_us ? elapsed : max_us;
+            vertices += stats.vertices;
+            edges += stats.edges;
+            if (!args.quiet)
+                printf("%s\t%d\t%d\t%d\t%ld\t%ld\t%ld\t%ld\n", variant_names[variant], sources[q], targets[q],
+                       h, weighted ? cost : h, elapsed, stats.vertices, stats.edges);
+        }
+        printf("%s: %d queries, %d reachable, total %.3f ms, mean %.1f us, max %ld us, "
+               "mean %.1f vertices and %.1f edges visited",
+               variant_names[variant], args.queries, reachable, total_us / 1000.0, (double)total_us / args.queries,
+               max_us, (double)vertices / args.queries, (double)edges / args.queries);
+        if (!reference)
+            printf(", %d %s mismatches with %s", mismatches, weighted ? "cost" : "hop count", variant_names[*first]);
+        printf("\n");
+    }
+
+    free(sources);
+    free(targets);
+    free(hops);
+    free(costs);
+    destroy_graph(graph);
+    free(graph);
+    if (team != NULL)
+    {
+        destroy_bfs_team(team);
+        free(team);
+    }
+    if (compressed != NULL)
+    {
+        destroy_compressed_graph(compressed);
+        free(compressed);
+    }
+    if (landmarks != NULL)
+    {
+        destroy_landmark_index(landmarks);
+        free(landmarks);
+    }
+    if (reverse != NULL)
+    {
+        destroy_graph(reverse);
+        free(reverse);
+    }
+    return 0;
+}
+
+void parse_variants(char *list)
+{
+    int n = 0;
+    for (char *name = strtok(list, ","); name != NULL; name = strtok(NULL, ","))
+    {
+        int variant = -1;
+        for (int v = 0; v < VARIANT_COUNT; v++)
+            if (strcmp(name, variant_names[v]) == 0)
+                variant = v;
+        if (variant == -1 || n == VARIANT_COUNT)
+        {
+            fprintf(stderr, "Variants (b) arg, %s is not one of paths, parent, bidir, alt, varint, bitmap, parallel, dijkstra, bidijkstra.", name);
+            exit(EXIT_FAILURE);
+        }
+        args.variants[n++] = variant;
+    }
+    if (n < VARIANT_COUNT)
+        args.variants[n] = -1;
+}
+
+void bfsbench_parse_args(int argc, char **argv)
+{
+    int iflag = FALSE;
+    args.queries = 100;
+    args.lookups = 100000;
+    args.quiet = FALSE;
+    args.seed = 1;
+    args.landmarks = 16;
+    args.order = ORDER_NONE;
+    args.helpers = 3;
+    for (int v = 0; v < VARIANT_COUNT; v++)
+        args.variants[v] = v;
+
+    char opt;
+    while ((opt = getopt(argc, argv, "i:n:e:b:r:L:O:P:q")) != -1)
+    {
+        switch (opt)
+        {
+        case 'i':
+            args.input = optarg;
+            iflag = TRUE;
+            break;
+        case 'n':
+            if ((args.queries = str_to_int(optarg)) < 1)
+            {
+                fprintf(stderr, "Number of queries (n) arg, is not in range [1, +inf].");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'e':
+            if ((args.lookups = str_to_int(optarg)) < 0)
+            {
+                fprintf(stderr, "Number of edge lookups (e) arg, is not in range [0, +inf].");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'b':
+            parse_variants(optarg);
+            break;
+        case 'r':
+            args.seed = str_to_int(optarg);
+            break;
+        case 'L':
+            if ((args.landmarks = str_to_int(optarg)) < 1)
+            {
+                fprintf(stderr, "Number of landmarks (L) arg, is not in range [1, +inf].");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'O':
+            if ((args.order = parse_order(optarg)) == -1)
+            {
+                fprintf(stderr, "Vertex order (O) arg, is not one of none, bfs, rcm, degree.");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'P':
+            if ((args.helpers = str_to_int(optarg)) < 0)
+            {
+                fprintf(stderr, "Number of helper threads (P) arg, is not in range [0, +inf].");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'q':
+            args.quiet = TRUE;
+            break;
+        case '?':
+        default:
+            bfsbench_help();
+            exit(EXIT_SUCCESS);
+            break;
+        }
+    }
+    check_arg(iflag, 'i');
+}
+
+void bfsbench_help()
+{
+    printf("Usage: ./bfsbench -i <graph_file> [-n <queries>] [-e <edge_lookups>] [-b <variants>] [-r <seed>] [-L <landmarks>] [-O <order>] [-P <helpers>] [-q]\n"
+           "Example: $./bfsbench -i graph.txt -n 1000 -b parent,bidir -q\n"
+           "\t-n:\t\trandom source/target queries per variant, 100 by default\n"
+           "\t-e:\t\trandom edge() lookups, 100000 by default\n"
+           "\t-b:\t\tcomma separated BFS variants: paths, parent, bidir, alt, varint, bitmap, parallel, and the\n"
+           "\t\t\tcost minimal dijkstra, bidijkstra over the weight column (all by default)\n"
+           "\t-L:\t\tlandmarks of the alt variant, 16 by default\n"
+           "\t-O:\t\trelabel the vertices first: none (default), bfs, rcm, degree\n"
+           "\t-P:\t\thelper threads of the parallel variant, 3 by default\n"
+           "\t-q:\t\tonly print the summaries, not every query\n"
+           "\t--help:\t\tdisplay what you are reading now\n\n"
+           "Exit status:\n"
+           "0\tif OK,\n"
+           "1\tif minor problems (e.g., cannot find the file.).\n\n\n");
+}
@@ -0,0 +1,78 @@
+#ifndef BITSET_H
+#define BITSET_H
+
+#include "utils.h"
+#include <string.h>
+
+/**
+ * bitset.h
+ * dense vertex sets, one bit per vertex in 64 bit words. members are
+ * counted with popcount and walked with count trailing zeros.
+ * @see graph.h
+ **/
+
+#define BITSET_WORD 64
+
+int bitset_words(int n)
+{
+    return (n + BITSET_WORD - 1) / BITSET_WORD;
+}
+
+unsigned long *create_bitset(int n)
+{
+    unsigned long *bits = (unsigned long *)xmalloc(sizeof(unsigned long) * (bitset_words(n) + 1));
+    memset(bits, 0, sizeof(unsigned long) * (bitset_words(n) + 1));
+    return bits;
+}
+
+void clear_bitset(unsigned long *bits, int n)
+{
+    memset(bits, 0, sizeof(unsigned long) * bitset_words(n));
+}
+
+int bitset_test(const unsigned long *bits, int i)
+{
+    return (bits[i / BITSET_WORD] >> (i % BITSET_WORD)) & 1;
+}
+
+void bitset_set(unsigned long *bits, int i)
+{
+    bits[i / BITSET_WORD] |= 1UL << (i % BITSET_WORD);
+}
+
+/* sets the bit, returns TRUE if it was clear. */
+int bitset_test_and_set(unsigned long *bits, int i)
+{
+    unsigned long mask = 1UL << (i % BITSET_WORD);
+    if (bits[i / BITSET_WORD] & mask)
+        return FALSE;
+    bits[i / BITSET_WORD] |= mask;
+    return TRUE;
+}
+
+int bitset_count(const unsigned long *bits, int n)
+{
+    int count = 0;
+    for (int w = 0; w < bitset_words(n); w++)
+        count += __builtin_popcountl(bits[w]);
+    return count;
+}
+
+/* first member >= from, -1 if there is none. */
+int bitset_next(const unsigned long *bits, int n, int from)
+{
+    if (from >= n)
+        return -1;
+    int w = from / BITSET_WORD;
+    unsigned long word = bits[w] & (~0UL << (from % BITSET_WORD));
+    while (word == 0)
+    {
+        if (++w >= bitset_words(n))
+            return -1;
+        word = bits[w];
+    }
+    int i = w * BITSET_WORD + __builtin_ctzl(word);
+    return i < n ? i : -1;
+}
+
+#endif
@@ -1,56 +1,177 @@
 #ifndef CACHE_H
 #define CACHE_H
 #include "utils.h"
+#include <stdatomic.h>
+#include <string.h>
+
+/**
+ * cache.h
+ * paths found so far, a list of (target, kind, path) per source, kind the
+ * QUERY_* type that found the path. a node and its
+ * path are one object carved from slabs of the node's size class (powers
+ * of two from 32 bytes), freed objects are kept on a list per class for the
+ * next insert; nodes over the largest class get a block of their own. a
+ * dropped cache hands back its slabs whole, without walking the entries.
+ * with a limit, an insert that needs more memory than the limit leaves is
+ * refused, and the owner clears the cache, slabs and all, once no reader
+ * holds a path of it.
+ * @see server.c
+ **/
+
+#define SLAB_BYTES (1 << 16)
+#define SLAB_MIN_SHIFT 5 // smallest class holds 32 bytes.
+#define SLAB_CLASSES 8   // up to 4096 bytes.
 
 struct CacheNode
 {
-    int vertex;
-    char *path;
     struct CacheNode *next;
+    int vertex;
+    int kind;
+    char path[]; // '\0' terminated.
+};
+
+/* memory taken from malloc: a slab, or one oversized node */
+struct Block
+{
+    struct Block *prev, *next;
 };
 
 struct Cache
 {
     int V;
     struct CacheNode **list;
+    struct Block *blocks[SLAB_CLASSES + 1]; // the last one holds the oversized nodes.
+    void *free[SLAB_CLASSES];               // linked through their first word.
+    atomic_long reserved, used, entries;    // bytes from malloc, bytes of live nodes.
+    long limit;                             // of reserved, 0 for none.
 };
 
-struct CacheNode *create_cache_node(int v, char *path)
+int slab_class(long bytes)
+{
+    int c = 0;
+    while (c < SLAB_CLASSES && (1L << (SLAB_MIN_SHIFT + c)) < bytes)
+        c++;
+    return c;
+}
+
+long slab_size(int c, long bytes)
+{
+    return c < SLAB_CLASSES ? 1L << (SLAB_MIN_SHIFT + c) : bytes;
+}
+
+long node_bytes(const char *path)
+{
+    return sizeof(struct CacheNode) + strlen(path) + 1;
+}
+
+/* bytes an object of this size takes from malloc, 0 if its class has one free. */
+long slab_grows(struct Cache *cache, long bytes)
+{
+    int c = slab_class(bytes);
+    if (c == SLAB_CLASSES)
+        return sizeof(struct Block) + bytes;
+    return cache->free[c] == NULL ? (long)sizeof(struct Block) + SLAB_BYTES : 0;
+}
+
+struct Block *add_block(struct Cache *cache, int c, long bytes)
+{
+    struct Block *block = (struct Block *)xmalloc(sizeof(struct Block) + bytes);
+    block->prev = NULL;
+    block->next = cache->blocks[c];
+    if (block->next != NULL)
+        block->next->prev = block;
+    cache->blocks[c] = block;
+    atomic_fetch_add_explicit(&cache->reserved, sizeof(struct Block) + bytes, memory_order_relaxed);
+    return block;
+}
+
+void *slab_alloc(struct Cache *cache, long bytes)
+{
+    int c = slab_class(bytes);
+    atomic_fetch_add_explicit(&cache->used, slab_size(c, bytes), memory_order_relaxed);
+    if (c == SLAB_CLASSES)
+        return add_block(cache, c, bytes) + 1;
+    if (cache->free[c] == NULL) // carve a new slab, lowest address first out.
+    {
+        char *objects = (char *)(add_block(cache, c, SLAB_BYTES) + 1);
+        long size = slab_size(c, bytes);
+        for (long off = SLAB_BYTES - size; off >= 0; off -= size)
+        {
+            *(void **)(objects + off) = cache->free[c];
+            cache->free[c] = objects + off;
+        }
+    }
+    void *object = cache->free[c];
+    cache->free[c] = *(void **)object;
+    return object;
+}
+
+void slab_free(struct Cache *cache, void *object, long bytes)
 {
-    struct CacheNode *node = (struct CacheNode *)xmalloc(sizeof(struct CacheNode));
-    node->vertex = v;
-    node->next = NULL;
-    node->path = path;
-    return node;
+    int c = slab_class(bytes);
+    atomic_fetch_sub_explicit(&cache->used, slab_size(c, bytes), memory_order_relaxed);
+    if (c < SLAB_CLASSES)
+    {
+        *(void **)object = cache->free[c];
+        cache->free[c] = object;
+        return;
+    }
+    struct Block *block = (struct Block *)object - 1;
+    if (block->prev != NULL)
+        block->prev->next = block->next;
+    else
+        cache->blocks[c] = block->next;
+    if (block->next != NULL)
+        block->next->prev = block->prev;
+    atomic_fetch_sub_explicit(&cache->reserved, sizeof(struct Block) + bytes, memory_order_relaxed);
+    free(block);
 }
 
-struct Cache *create_cache(int V)
+struct Cache *create_cache(int V, long limit)
 {
     struct Cache *cache = (struct Cache *)xmalloc(sizeof(struct Cache));
     cache->V = V;
+    cache->limit = limit;
     cache->list = (struct CacheNode **)xmalloc(V * sizeof(struct CacheNode *));
 
     for (int i = 0; i < V; i++)
         cache->list[i] = NULL;
+    for (int c = 0; c <= SLAB_CLASSES; c++)
+        cache->blocks[c] = NULL;
+    for (int c = 0; c < SLAB_CLASSES; c++)
+        cache->free[c] = NULL;
+    atomic_init(&cache->reserved, 0);
+    atomic_init(&cache->used, 0);
+    atomic_init(&cache->entries, 0);
 
     return cache;
 }
 
-void to_cache(struct Cache *cache, int i, int j, char *path)
+/* copies path in, the caller keeps it. FALSE if it would take the cache over its limit. */
+int to_cache(struct Cache *cache, int i, int j, int kind, const char *path)
 {
-    struct CacheNode *node = create_cache_node(j, path);
+    long bytes = node_bytes(path);
+    long grows = slab_grows(cache, bytes);
+    if (cache->limit > 0 && grows > 0 && atomic_load(&cache->reserved) + grows > cache->limit)
+        return FALSE;
+    struct CacheNode *node = (struct CacheNode *)slab_alloc(cache, bytes);
+    node->vertex = j;
+    node->kind = kind;
+    memcpy(node->path, path, bytes - sizeof(struct CacheNode));
 
     /* connect new node to rest of the neighbours */
     node->next = cache->list[i];
     cache->list[i] = node;
+    atomic_fetch_add_explicit(&cache->entries, 1, memory_order_relaxed);
+    return TRUE;
 }
 
-long get_cache(struct Cache *cache, int i, int j)
+long get_cache(struct Cache *cache, int i, int j, int kind)
 {
     struct CacheNode *node = cache->list[i];
     while (node != NULL)
     {
-        if (node->vertex == j)
+        if (node->vertex == j && node->kind == kind)
             return (long)node->path;
         node = node->next;
     }
@@ -58,21 +179,58 @@ long get_cache(struct Cache *cache, int i, int j)
     return FALSE;
 }
 
-void delete_cache_node(struct CacheNode *node)
+/* removes every entry stale() returns TRUE for, returns how many. */
+int evict_cache_if(struct Cache *cache, int (*stale)(int i, int j, int kind, char *path, void *arg), void *arg)
 {
-    while (node != NULL)
+    int evicted = 0;
+    for (int i = 0; i < cache->V; i++)
     {
-        delete_cache_node(node->next);
-        free(node->path);
-        free(node);
+        struct CacheNode **link = &cache->list[i];
+        while (*link != NULL)
+        {
+            struct CacheNode *node = *link;
+            if (!stale(i, node->vertex, node->kind, node->path, arg))
+            {
+                link = &node->next;
+                continue;
+            }
+            *link = node->next;
+            slab_free(cache, node, node_bytes(node->path));
+            evicted++;
+        }
     }
+    atomic_fetch_sub_explicit(&cache->entries, evicted, memory_order_relaxed);
+    return evicted;
 }
 
-void destroy_cache(struct Cache *cache)
+void free_blocks(struct Cache *cache)
+{
+    for (int c = 0; c <= SLAB_CLASSES; c++)
+        while (cache->blocks[c] != NULL)
+        {
+            struct Block *next = cache->blocks[c]->next;
+            free(cache->blocks[c]);
+            cache->blocks[c] = next;
+        }
+}
+
+/* drops every entry and hands all the slabs back to malloc, returns how many entries. */
+long clear_cache(struct Cache *cache)
 {
+    free_blocks(cache);
     for (int i = 0; i < cache->V; i++)
-        delete_cache_node(cache->list[i]);
+        cache->list[i] = NULL;
+    for (int c = 0; c < SLAB_CLASSES; c++)
+        cache->free[c] = NULL;
+    atomic_store(&cache->reserved, 0);
+    atomic_store(&cache->used, 0);
+    return atomic_exchange(&cache->entries, 0);
+}
+
+void destroy_cache(struct Cache *cache)
+{
+    free_blocks(cache);
     free(cache->list);
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -14,6 +14,10 @@ struct ClientArgs
 {
     char host_addr[32];
     int port, src, dest;
+    unsigned int type; // QUERY_* in utils.h
+    unsigned int k;    // paths of a QUERY_KPATHS query.
+    unsigned int timeout_ms; // the server gives up the search after it, 0 for never.
+    char *updates;     // edge list file of add/remove queries.
 };
 
 void client_parse_args(int argc, char **argv, struct ClientArgs *args);
@@ -21,6 +25,7 @@ void check_arg(int flag, char arg);
 void prepare_packet(struct ClientArgs *args, char *buf);
 void client_help();
 char *timestamp();
+struct Edge *read_edges(char *file, int *count);
 
 int main(int argc, char *argv[])
 {
@@ -30,6 +35,13 @@ int main(int argc, char *argv[])
 
     char packet[MAX_BYTE];
 
+    int update = args.type == QUERY_ADD || args.type == QUERY_REMOVE, count = 0;
+    struct Edge *edges = NULL;
+    if (update)
+    {
+        edges = read_edges(args.updates, &count);
+        args.src = count; // sent as i1.
+    }
     prepare_packet(&args, packet);
 
     int sockfd;
@@ -48,8 +60,39 @@ int main(int argc, char *argv[])
     if (connect(sockfd, (struct sockaddr *)&host_addr, sizeof(host_addr)) != 0)
         xerror(__func__, "client connect");
 
-    printf("[%s] Client (%d) connected and requesting path from node %d to %d\n", timestamp(), pid, args.src, args.dest);
+    if (args.type == QUERY_STATS)
+        printf("[%s] Client (%d) connected and requesting statistics\n", timestamp(), pid);
+    else if (update)
+        printf("[%s] Client (%d) connected and sending %d edges to %s\n", timestamp(), pid, args.src,
+               args.type == QUERY_ADD ? "add" : "remove");
+    else if (args.type == QUERY_KPATHS)
+        printf("[%s] Client (%d) connected and requesting %u paths from node %d to %d\n", timestamp(), pid, args.k,
+               args.src, args.dest);
+    else
+        printf("[%s] Client (%d) connected and requesting path from node %d to %d\n", timestamp(), pid, args.src, args.dest);
     xwrite(sockfd, packet, sizeof(struct Packet));
+    if (args.type == QUERY_KPATHS)
+        xwrite(sockfd, &args.k, sizeof(args.k));
+
+    if (update)
+    {
+        xwrite(sockfd, edges, sizeof(struct Edge) * count);
+        free(edges);
+    }
+
+    if (args.type == QUERY_STATS || args.type == QUERY_KPATHS || update)
+    {
+        // multiple lines, the server closes the connection when done.
+        int read_byte;
+        printf(update ? "[%s] Server's response: "
+               : args.type == QUERY_KPATHS ? "[%s] Server's paths:\n" : "[%s] Server's statistics:\n", timestamp());
+        while ((read_byte = xread(sockfd, packet, MAX_BYTE)) > 0)
+            fwrite(packet, 1, read_byte, stdout);
+        if (args.type != QUERY_STATS)
+            printf("\n");
+        close(sockfd);
+        return 0;
+    }
 
     int read_byte = 0;
     int first = TRUE;
@@ -80,16 +123,45 @@ int main(int argc, char *argv[])
 
 void prepare_packet(struct ClientArgs *args, char *buf)
 {
-    struct Packet packet = {args->src, args->dest};
+    struct Packet packet = {args->type, args->src, args->dest, args->timeout_ms};
     memcpy(buf, &packet, sizeof(struct Packet));
 }
 
+/* edges of a "i<TAB>j" per line file, like the graph file of the server. */
+struct Edge *read_edges(char *file, int *count)
+{
+    FILE *fp = fopen(file, "r");
+    if (fp == NULL)
+        xerror(__func__, "fopen");
+    int cap = 64;
+    struct Edge *edges = (struct Edge *)xmalloc(sizeof(struct Edge) * cap);
+    char line[MAX_BYTE];
+    *count = 0;
+    while (fgets(line, MAX_BYTE, fp) != NULL && *count < UPDATE_MAX_EDGES)
+    {
+        unsigned int from, to;
+        if (line[0] == '#' || sscanf(line, "%u %u", &from, &to) != 2)
+            continue;
+        if (*count == cap)
+            edges = (struct Edge *)xrealloc(edges, sizeof(struct Edge) * (cap *= 2));
+        edges[*count].from = from;
+        edges[(*count)++].to = to;
+    }
+    fclose(fp);
+    return edges;
+}
+
 void client_parse_args(int argc, char **argv, struct ClientArgs *args)
 {
-    int aflag = FALSE, pflag = FALSE, sflag = FALSE, dflag = FALSE;
+    int aflag = FALSE, pflag = FALSE, sflag = FALSE, dflag = FALSE, uflag = FALSE;
+    args->type = QUERY_PATH;
+    args->src = args->dest = 0;
+    args->updates = NULL;
+    args->k = 3;
+    args->timeout_ms = 0;
 
     char opt;
-    while ((opt = getopt(argc, argv, "a:p:s:d:")) != -1)
+    while ((opt = getopt(argc, argv, "a:p:s:d:q:u:k:t:")) != -1)
     {
         switch (opt)
         {
@@ -124,6 +196,49 @@ void client_parse_args(int argc, char **argv, struct ClientArgs *args)
                 exit(EXIT_FAILURE);
             }
             break;
+        case 'q':
+            if (strcmp(optarg, "path") == 0)
+                args->type = QUERY_PATH;
+            else if (strcmp(optarg, "weighted") == 0)
+                args->type = QUERY_WEIGHTED;
+            else if (strcmp(optarg, "paths") == 0)
+                args->type = QUERY_KPATHS;
+            else if (strcmp(optarg, "reach") == 0)
+                args->type = QUERY_REACH;
+            else if (strcmp(optarg, "distance") == 0)
+                args->type = QUERY_DISTANCE;
+            else if (strcmp(optarg, "stats") == 0)
+                args->type = QUERY_STATS;
+            else if (strcmp(optarg, "add") == 0)
+                args->type = QUERY_ADD;
+            else if (strcmp(optarg, "remove") == 0)
+                args->type = QUERY_REMOVE;
+            else
+            {
+                fprintf(stderr, "Query type (q) arg, is not one of path, weighted, paths, reach, distance, stats, add, remove.");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'k':
+            if (str_to_int(optarg) < 1)
+            {
+                fprintf(stderr, "Number of paths (k) arg, is not in range [1, MAX_INT].");
+                exit(EXIT_FAILURE);
+            }
+            args->k = str_to_int(optarg);
+            break;
+        case 't':
+            if (str_to_int(optarg) < 0)
+            {
+                fprintf(stderr, "Timeout (t) arg, is not in range [0, MAX_INT].");
+                exit(EXIT_FAILURE);
+            }
+            args->timeout_ms = str_to_int(optarg);
+            break;
+        case 'u':
+            args->updates = optarg;
+            uflag = TRUE;
+            break;
         case '?':
         default:
             client_help();
@@ -133,14 +248,28 @@ void client_parse_args(int argc, char **argv, struct ClientArgs *args)
     }
     check_arg(aflag, 'a');
     check_arg(pflag, 'p');
-    check_arg(sflag, 's');
-    check_arg(dflag, 'd');
+    if (args->type == QUERY_ADD || args->type == QUERY_REMOVE)
+    {
+        check_arg(uflag, 'u');
+    }
+    else if (args->type != QUERY_STATS)
+    {
+        check_arg(sflag, 's');
+        check_arg(dflag, 'd');
+    }
 }
 
 void client_help()
 {
-    printf("Usage: ./client -a <server_address> -p <port> -s <src_node> -d <dest_node>\n"
+    printf("Usage: ./client -a <server_address> -p <port> -s <src_node> -d <dest_node> [-q <query>] [-k <paths>] [-t <ms>]\n"
+           "              [-u <edge_file>]\n"
            "Example: $./client -a 127.0.0.1 -p PORT -s 768 -d 979\n"
+           "\t-q:\t\tquery type, path (default), weighted, paths, reach, distance, stats, add or remove\n"
+           "\t\t\t(weighted: the path of least total weight, paths: the k cheapest, reach and distance:\n"
+           "\t\t\tno path, just yes/no or the hops; -s and -d are not needed for stats, add, remove)\n"
+           "\t-k:\t\tpaths of a paths query, 3 by default\n"
+           "\t-t:\t\tmilliseconds after which the server gives up the search, none by default\n"
+           "\t-u:\t\tedges to add or remove, one \"i<TAB>j\" per line\n"
            "\t--help:\t\tdisplay what you are reading now\n\n"
            "Exis status:\n"
            "0\tif OK,\n"
@@ -0,0 +1,420 @@
+#ifndef COMPRESSED_H
+#define COMPRESSED_H
+
+#include "utils.h"
+#include "graph.h"
+#include <stdlib.h>
+
+/**
+ * compressed.h
+ * read only adjacency where every vertex's neighbor list is sorted and
+ * delta encoded as LEB128 varints: the first neighbor relative to the vertex
+ * itself (zigzag, it may be smaller), the rest as gaps to the previous one.
+ * after relabeling (-O) most gaps fit one byte, against the 16 bytes of an
+ * AdjacencyNode. lists are decoded on the fly while searching. under -C they
+ * are built straight from the file, no linked graph ever exists.
+ * @see server.c
+ **/
+
+struct CompressedGraph
+{
+    int V;
+    long edges;
+    int weighted;        // some edge of the file weighs other than 1, the weights are not kept.
+    long *offset;        // neighbors of v are encoded in data[offset[v], offset[v + 1]).
+    unsigned char *data;
+};
+
+/* walks the neighbors of one vertex. */
+struct Neighbors
+{
+    const unsigned char *p, *end;
+    long last; // previous neighbor, or the vertex itself before the first one.
+    int first;
+};
+
+unsigned long zigzag(long v)
+{
+    return v < 0 ? ((unsigned long)-v << 1) - 1 : (unsigned long)v << 1;
+}
+
+long unzigzag(unsigned long v)
+{
+    return (v & 1) ? -(long)((v + 1) >> 1) : (long)(v >> 1);
+}
+
+/* appends v to data[*len], growing data, returns the (possibly moved) buffer. */
+unsigned char *put_varint(unsigned char *data, long *len, long *cap, unsigned long v)
+{
+    if (*len + 10 > *cap)
+    {
+        *cap = *cap * 2 + 16;
+        data = (unsigned char *)xrealloc(data, *cap);
+    }
+    while (v >= 0x80)
+    {
+        data[(*len)++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    data[(*len)++] = (unsigned char)v;
+    return data;
+}
+
+unsigned long get_varint(const unsigned char **p)
+{
+    unsigned long v = 0;
+    int shift = 0;
+    while (**p & 0x80)
+    {
+        v |= (unsigned long)(*(*p)++ & 0x7f) << shift;
+        shift += 7;
+    }
+    v |= (unsigned long)(*(*p)++) << shift;
+    return v;
+}
+
+int compare_ints(const void *a, const void *b)
+{
+    int x = *(const int *)a, y = *(const int *)b;
+    return x < y ? -1 : x > y;
+}
+
+unsigned long varint_size(unsigned long v)
+{
+    unsigned long n = 1;
+    for (; v >= 0x80; v >>= 7)
+        n++;
+    return n;
+}
+
+/* the varint lists of a graph given as rows: the neighbors of v are
+ * targets[rows[v], rows[v + 1]). sorts every run in place, then encodes
+ * into a buffer of the exact size. rows and targets stay the caller's. */
+struct CompressedGraph *encode_rows(int V, long *rows, int *targets, int weighted)
+{
+    struct CompressedGraph *cg = (struct CompressedGraph *)xmalloc(sizeof(struct CompressedGraph));
+    cg->V = V;
+    cg->edges = rows[V];
+    cg->weighted = weighted;
+    cg->offset = (long *)xmalloc(sizeof(long) * (V + 1));
+
+    long len = 0;
+    for (int v = 0; v < V; v++)
+    {
+        qsort(targets + rows[v], rows[v + 1] - rows[v], sizeof(int), compare_ints);
+        for (long i = rows[v]; i < rows[v + 1]; i++)
+            len += varint_size(i == rows[v] ? zigzag((long)targets[i] - v) : (unsigned long)(targets[i] - targets[i - 1]));
+    }
+    long cap = len + 16; // put_varint() never grows it.
+    cg->data = (unsigned char *)xmalloc(cap);
+    len = 0;
+    for (int v = 0; v < V; v++)
+    {
+        cg->offset[v] = len;
+        for (long i = rows[v]; i < rows[v + 1]; i++)
+            put_varint(cg->data, &len, &cap, i == rows[v] ? zigzag((long)targets[i] - v) : (unsigned long)(targets[i] - targets[i - 1]));
+    }
+    cg->offset[V] = len;
+    return cg;
+}
+
+/* rows[v + 1] holds a count for every v, turns them into run starts. */
+void prefix_rows(int V, long *rows)
+{
+    rows[0] = 0;
+    for (int v = 0; v < V; v++)
+        rows[v + 1] += rows[v];
+}
+
+struct CompressedGraph *compress_graph(struct Graph *graph)
+{
+    int V = graph->V;
+    long *rows = (long *)xmalloc(sizeof(long) * (V + 1));
+    for (int v = 0; v < V; v++)
+    {
+        rows[v + 1] = 0;
+        for (struct AdjacencyNode *adj = graph->list[v]; adj != NULL; adj = adj->next)
+            rows[v + 1]++;
+    }
+    prefix_rows(V, rows);
+    int *targets = (int *)xmalloc(sizeof(int) * (rows[V] + 1));
+    for (int v = 0; v < V; v++)
+    {
+        long n = rows[v];
+        for (struct AdjacencyNode *adj = graph->list[v]; adj != NULL; adj = adj->next)
+            targets[n++] = adj->vertex;
+    }
+    struct CompressedGraph *cg = encode_rows(V, rows, targets, graph->weighted);
+    free(rows);
+    free(targets);
+    return cg;
+}
+
+/* load_graph() of graph.h straight into varint lists, without a single
+ * AdjacencyNode: the out-degrees are counted over the file, the targets
+ * dropped into their rows, the file freed, then every row sorted and
+ * encoded. at the peak it holds 4 bytes per edge and 8 per vertex besides
+ * the encoding. the weights are only looked at to set cg->weighted. */
+struct CompressedGraph *load_compressed_graph(int fd, int *edge_count)
+{
+    char *raw;
+    *edge_count = 0;
+    int V;
+    if (read_raw(fd, &raw) == -1 || (V = find_V(raw, edge_count)) == -1)
+    {
+        free(raw);
+        return NULL;
+    }
+
+    long *rows = (long *)xmalloc(sizeof(long) * (V + 1));
+    for (int v = 0; v <= V; v++)
+        rows[v] = 0;
+    int i, j, weight, weighted = FALSE;
+    for (const char *p = raw; p != NULL && *p != '\0'; p = next_line(p))
+        if (parse_edge(p, &i, &j, &weight) == 1) // find_V checked them all.
+            rows[i + 1]++;
+    prefix_rows(V, rows);
+
+    int *targets = (int *)xmalloc(sizeof(int) * (rows[V] + 1));
+    long *fill = (long *)xmalloc(sizeof(long) * (V + 1));
+    memcpy(fill, rows, sizeof(long) * (V + 1));
+    for (const char *p = raw; p != NULL && *p != '\0'; p = next_line(p))
+        if (parse_edge(p, &i, &j, &weight) == 1)
+        {
+            targets[fill[i]++] = j;
+            weighted |= weight != 1;
+        }
+    free(fill);
+    free(raw);
+
+    *edge_count = (int)rows[V];
+    struct CompressedGraph *cg = encode_rows(V, rows, targets, weighted);
+    free(rows);
+    free(targets);
+    return cg;
+}
+
+struct CompressedGraph *copy_compressed_graph(struct CompressedGraph *cg)
+{
+    struct CompressedGraph *copy = (struct CompressedGraph *)xmalloc(sizeof(struct CompressedGraph));
+    copy->V = cg->V;
+    copy->edges = cg->edges;
+    copy->weighted = cg->weighted;
+    copy->offset = (long *)xmalloc(sizeof(long) * (cg->V + 1));
+    memcpy(copy->offset, cg->offset, sizeof(long) * (cg->V + 1));
+    copy->data = (unsigned char *)xmalloc(cg->offset[cg->V] + 1);
+    memcpy(copy->data, cg->data, cg->offset[cg->V] + 1);
+    return copy;
+}
+
+long compressed_bytes(struct CompressedGraph *cg)
+{
+    return cg->offset[cg->V] + sizeof(long) * (cg->V + 1);
+}
+
+void neighbors_begin(struct CompressedGraph *cg, int v, struct Neighbors *it)
+{
+    it->p = cg->data + cg->offset[v];
+    it->end = cg->data + cg->offset[v + 1];
+    it->last = v;
+    it->first = TRUE;
+}
+
+/* stores the next neighbor into w, FALSE when there are none left. */
+int neighbors_next(struct Neighbors *it, int *w)
+{
+    if (it->p == it->end)
+        return FALSE;
+    unsigned long v = get_varint(&it->p);
+    it->last += it->first ? unzigzag(v) : (long)v;
+    it->first = FALSE;
+    *w = (int)it->last;
+    return TRUE;
+}
+
+void destroy_compressed_graph(struct CompressedGraph *cg)
+{
+    free(cg->offset);
+    free(cg->data);
+}
+
+/* the adjacency of a snapshot, linked or varint encoded, for what is built
+ * once over it (the component and landmark indexes, the vertex order). */
+struct Adjacency
+{
+    int V;
+    struct Graph *graph;                // NULL under -C.
+    struct CompressedGraph *compressed; // NULL without -C.
+};
+
+/* walks the neighbors of one vertex of either. */
+struct Cursor
+{
+    struct AdjacencyNode *node;
+    struct Neighbors it;
+};
+
+struct Adjacency linked_adjacency(struct Graph *graph)
+{
+    struct Adjacency a = {graph->V, graph, NULL};
+    return a;
+}
+
+struct Adjacency varint_adjacency(struct CompressedGraph *cg)
+{
+    struct Adjacency a = {cg->V, NULL, cg};
+    return a;
+}
+
+void cursor_begin(const struct Adjacency *a, int v, struct Cursor *c)
+{
+    if (a->graph != NULL)
+        c->node = a->graph->list[v];
+    else
+        neighbors_begin(a->compressed, v, &c->it);
+}
+
+/* stores the next neighbor into w, FALSE when there are none left. */
+int cursor_next(const struct Adjacency *a, struct Cursor *c, int *w)
+{
+    if (a->graph == NULL)
+        return neighbors_next(&c->it, w);
+    if (c->node == NULL)
+        return FALSE;
+    *w = c->node->vertex;
+    c->node = c->node->next;
+    return TRUE;
+}
+
+/* reverse_graph() of graph.h for varint lists, through rows of in-degrees. */
+struct CompressedGraph *reverse_compressed_graph(struct CompressedGraph *cg)
+{
+    int V = cg->V, w;
+    struct Neighbors it;
+    long *rows = (long *)xmalloc(sizeof(long) * (V + 1));
+    for (int v = 0; v <= V; v++)
+        rows[v] = 0;
+    for (int v = 0; v < V; v++)
+        for (neighbors_begin(cg, v, &it); neighbors_next(&it, &w);)
+            rows[w + 1]++;
+    prefix_rows(V, rows);
+
+    int *targets = (int *)xmalloc(sizeof(int) * (rows[V] + 1));
+    long *fill = (long *)xmalloc(sizeof(long) * (V + 1));
+    memcpy(fill, rows, sizeof(long) * (V + 1));
+    for (int v = 0; v < V; v++)
+        for (neighbors_begin(cg, v, &it); neighbors_next(&it, &w);)
+            targets[fill[w]++] = v;
+    free(fill);
+
+    struct CompressedGraph *reverse = encode_rows(V, rows, targets, cg->weighted);
+    free(rows);
+    free(targets);
+    return reverse;
+}
+
+/* the same kind of adjacency with every edge turned around. */
+struct Adjacency reverse_adjacency(const struct Adjacency *a)
+{
+    return a->graph != NULL ? linked_adjacency(reverse_graph(a->graph)) : varint_adjacency(reverse_compressed_graph(a->compressed));
+}
+
+/* frees the graph behind a, for temporary ones like reverse_adjacency(). */
+void destroy_adjacency(struct Adjacency *a)
+{
+    if (a->graph != NULL)
+    {
+        destroy_graph(a->graph);
+        free(a->graph);
+    }
+    else
+    {
+        destroy_compressed_graph(a->compressed);
+        free(a->compressed);
+    }
+}
+
+/* bfs_parent() of graph.h over the compressed lists. */
+struct Queue *bfs_compressed(struct CompressedGraph *cg, int start, int end, struct SearchStats *stats)
+{
+    int *parent = (int *)xmalloc(sizeof(int) * cg->V);
+    int *frontier = (int *)xmalloc(sizeof(int) * cg->V);
+    for (int i = 0; i < cg->V; i++)
+        parent[i] = -1;
+
+    int head = 0, tail = 0;
+    parent[start] = start;
+    frontier[tail++] = start;
+    while (head < tail && parent[end] == -1)
+    {
+        int node = frontier[head++], w;
+        if (stats != NULL)
+            stats->vertices++;
+        if (search_cancelled(stats))
+            break;
+        struct Neighbors it;
+        neighbors_begin(cg, node, &it);
+        while (neighbors_next(&it, &w))
+        {
+            if (stats != NULL)
+                stats->edges++;
+            if (parent[w] == -1)
+            {
+                parent[w] = node;
+                frontier[tail++] = w;
+                if (w == end)
+                    break;
+            }
+        }
+    }
+
+    struct Queue *result = parent[end] == -1 ? NULL : trace_path(parent, start, end, cg->V);
+    free(parent);
+    free(frontier);
+    return result;
+}
+
+/* bfs_hops() of graph.h over the compressed lists. */
+int bfs_compressed_hops(struct CompressedGraph *cg, int start, int end, struct SearchStats *stats)
+{
+    if (start == end)
+        return 0;
+    unsigned long *visited = create_bitset(cg->V);
+    int *frontier = (int *)xmalloc(sizeof(int) * cg->V);
+    int head = 0, tail = 0, depth = 0, hops = -1;
+    bitset_set(visited, start);
+    frontier[tail++] = start;
+    while (hops == -1 && head < tail && !search_cancelled(stats))
+    {
+        int level_end = tail;
+        depth++;
+        while (hops == -1 && head < level_end)
+        {
+            int node = frontier[head++], w;
+            if (stats != NULL)
+                stats->vertices++;
+            if (search_cancelled(stats))
+                break;
+            struct Neighbors it;
+            neighbors_begin(cg, node, &it);
+            while (neighbors_next(&it, &w))
+            {
+                if (stats != NULL)
+                    stats->edges++;
+                if (!bitset_test_and_set(visited, w))
+                    continue;
+                if (w == end)
+                {
+                    hops = depth;
+                    break;
+                }
+                frontier[tail++] = w;
+            }
+        }
+    }
+    free(visited);
+    free(frontier);
+    return hops;
+}
+
+#endif
@@ -0,0 +1,270 @@
+#ifndef DIJKSTRA_H
+#define DIJKSTRA_H
+
+#include "utils.h"
+#include "graph.h"
+
+/**
+ * dijkstra.h
+ * cost minimal paths over the weights of the third input column. the
+ * frontier is a radix heap: keys never drop below the last one taken, so
+ * an item sits in the bucket of the highest bit where it differs from it
+ * and every item moves down at most 64 times. a vertex is pushed again
+ * when its cost drops, older copies are skipped when they come out. the
+ * bidirectional search runs one heap per end over graph and its reverse.
+ * @see server.c
+ **/
+
+#define RADIX_BUCKETS 65 // bucket 0 holds keys equal to the last one taken.
+#define BAN_VERTEX 1     // dijkstra_avoiding(): the vertex may not be entered,
+#define BAN_FROM_START 2 // nor by an edge out of the start if this is set.
+
+struct RadixItem
+{
+    unsigned long key;
+    int vertex;
+};
+
+struct RadixBucket
+{
+    struct RadixItem *items;
+    int n, cap;
+};
+
+struct RadixHeap
+{
+    unsigned long last;
+    long size;
+    struct RadixBucket buckets[RADIX_BUCKETS];
+};
+
+void radix_init(struct RadixHeap *heap)
+{
+    heap->last = 0;
+    heap->size = 0;
+    for (int b = 0; b < RADIX_BUCKETS; b++)
+    {
+        heap->buckets[b].items = NULL;
+        heap->buckets[b].n = heap->buckets[b].cap = 0;
+    }
+}
+
+int radix_bucket(struct RadixHeap *heap, unsigned long key)
+{
+    return key == heap->last ? 0 : 64 - __builtin_clzl(key ^ heap->last);
+}
+
+void radix_put(struct RadixBucket *bucket, unsigned long key, int vertex)
+{
+    if (bucket->n == bucket->cap)
+    {
+        bucket->cap = bucket->cap ? 2 * bucket->cap : 16;
+        bucket->items = (struct RadixItem *)xrealloc(bucket->items, sizeof(struct RadixItem) * bucket->cap);
+    }
+    bucket->items[bucket->n].key = key;
+    bucket->items[bucket->n++].vertex = vertex;
+}
+
+/* key must not be below the last key popped. */
+void radix_push(struct RadixHeap *heap, unsigned long key, int vertex)
+{
+    radix_put(&heap->buckets[radix_bucket(heap, key)], key, vertex);
+    heap->size++;
+}
+
+/* smallest key, the heap must not be empty. refills bucket 0 from the
+ * first non empty one, whose items all land below it. */
+unsigned long radix_top(struct RadixHeap *heap)
+{
+    if (heap->buckets[0].n == 0)
+    {
+        int b = 1;
+        while (heap->buckets[b].n == 0)
+            b++;
+        struct RadixBucket *bucket = &heap->buckets[b];
+        unsigned long min = bucket->items[0].key;
+        for (int k = 1; k < bucket->n; k++)
+            if (bucket->items[k].key < min)
+                min = bucket->items[k].key;
+        heap->last = min;
+        for (int k = 0; k < bucket->n; k++)
+            radix_put(&heap->buckets[radix_bucket(heap, bucket->items[k].key)],
+                      bucket->items[k].key, bucket->items[k].vertex);
+        bucket->n = 0;
+    }
+    return heap->last;
+}
+
+int radix_pop(struct RadixHeap *heap, unsigned long *key)
+{
+    *key = radix_top(heap);
+    heap->size--;
+    return heap->buckets[0].items[--heap->buckets[0].n].vertex;
+}
+
+void radix_destroy(struct RadixHeap *heap)
+{
+    for (int b = 0; b < RADIX_BUCKETS; b++)
+        free(heap->buckets[b].items);
+}
+
+/* pops the next vertex whose cost is final, -1 once the heap runs dry. */
+int settle_next(struct RadixHeap *heap, long *dist)
+{
+    while (heap->size > 0)
+    {
+        unsigned long key;
+        int node = radix_pop(heap, &key);
+        if ((long)key == dist[node]) // older copies carry a higher cost.
+            return node;
+    }
+    return -1;
+}
+
+/* relaxes the edges out of node, returns the neighbor through which the
+ * best path over both searches improved (other_dist of the opposite side,
+ * NULL for a one sided search), or -1. neighbors w with banned[w] & mask
+ * are skipped, banned may be NULL. */
+int relax_edges(struct Graph *graph, struct RadixHeap *heap, int node, int *parent, long *dist,
+                long *other_dist, long *best, const char *banned, int mask, struct SearchStats *stats)
+{
+    int meet = -1;
+    if (stats != NULL)
+        stats->vertices++;
+    for (struct AdjacencyNode *adj = graph->list[node]; adj != NULL; adj = adj->next)
+    {
+        if (stats != NULL)
+            stats->edges++;
+        int w = adj->vertex;
+        if (banned != NULL && (banned[w] & mask))
+            continue;
+        long cost = dist[node] + adj->weight;
+        if (dist[w] != -1 && dist[w] <= cost)
+            continue;
+        dist[w] = cost;
+        parent[w] = node;
+        radix_push(heap, cost, w);
+        if (other_dist != NULL && other_dist[w] != -1 && (*best == -1 || cost + other_dist[w] < *best))
+        {
+            *best = cost + other_dist[w];
+            meet = w;
+        }
+    }
+    return meet;
+}
+
+/* cost minimal path from start to end, NULL if there is none. its cost
+ * goes to *cost. banned (may be NULL) holds BAN_* flags per vertex. */
+struct Queue *dijkstra_avoiding(struct Graph *graph, int start, int end, const char *banned, long *cost,
+                                struct SearchStats *stats)
+{
+    int V = graph->V;
+    int *parent = (int *)xmalloc(sizeof(int) * V);
+    long *dist = (long *)xmalloc(sizeof(long) * V);
+    for (int i = 0; i < V; i++)
+    {
+        parent[i] = -1;
+        dist[i] = -1;
+    }
+    struct RadixHeap heap;
+    radix_init(&heap);
+    parent[start] = start;
+    dist[start] = 0;
+    radix_push(&heap, 0, start);
+
+    int node = -1;
+    while (!search_cancelled(stats) && (node = settle_next(&heap, dist)) != -1 && node != end)
+        relax_edges(graph, &heap, node, parent, dist, NULL, NULL, banned,
+                    node == start ? BAN_VERTEX | BAN_FROM_START : BAN_VERTEX, stats);
+
+    struct Queue *result = NULL;
+    if (node == end)
+    {
+        *cost = dist[end];
+        result = trace_path(parent, start, end, V);
+    }
+    radix_destroy(&heap);
+    free(parent);
+    free(dist);
+    return result;
+}
+
+struct Queue *dijkstra(struct Graph *graph, int start, int end, long *cost, struct SearchStats *stats)
+{
+    return dijkstra_avoiding(graph, start, end, NULL, cost, stats);
+}
+
+/* dijkstra() from both ends, reverse must be reverse_graph(graph). the side
+ * with the lower next cost settles a vertex; once the two next costs add
+ * up to the best path seen through a vertex labeled by both, it is minimal. */
+struct Queue *dijkstra_bidirectional(struct Graph *graph, struct Graph *reverse, int start, int end,
+                                     long *cost, struct SearchStats *stats)
+{
+    if (start == end)
+        return dijkstra(graph, start, end, cost, stats);
+
+    int V = graph->V;
+    int *fparent = (int *)xmalloc(sizeof(int) * V), *bparent = (int *)xmalloc(sizeof(int) * V);
+    long *fdist = (long *)xmalloc(sizeof(long) * V), *bdist = (long *)xmalloc(sizeof(long) * V);
+    for (int i = 0; i < V; i++)
+    {
+        fparent[i] = bparent[i] = -1;
+        fdist[i] = bdist[i] = -1;
+    }
+    struct RadixHeap forward, backward;
+    radix_init(&forward);
+    radix_init(&backward);
+    fparent[start] = start;
+    fdist[start] = 0;
+    radix_push(&forward, 0, start);
+    bparent[end] = end;
+    bdist[end] = 0;
+    radix_push(&backward, 0, end);
+
+    long best = -1;
+    int meet = -1;
+    while (forward.size > 0 && backward.size > 0 && !search_cancelled(stats))
+    {
+        unsigned long ftop = radix_top(&forward), btop = radix_top(&backward);
+        if (best != -1 && (long)(ftop + btop) >= best)
+            break;
+        int found;
+        if (ftop <= btop)
+        {
+            int node = settle_next(&forward, fdist);
+            if (node == -1)
+                break;
+            found = relax_edges(graph, &forward, node, fparent, fdist, bdist, &best, NULL, 0, stats);
+        }
+        else
+        {
+            int node = settle_next(&backward, bdist);
+            if (node == -1)
+                break;
+            found = relax_edges(reverse, &backward, node, bparent, bdist, fdist, &best, NULL, 0, stats);
+        }
+        if (found != -1)
+            meet = found;
+    }
+
+    struct Queue *result = NULL;
+    if (meet != -1 && (stats == NULL || !stats->cancelled)) // a cut short search may hold a costlier meeting.
+    {
+        *cost = best;
+        result = trace_path(fparent, start, meet, V);
+        for (int v = meet; v != end;)
+        {
+            v = bparent[v];
+            enqueue(&result, v);
+        }
+    }
+    radix_destroy(&forward);
+    radix_destroy(&backward);
+    free(fparent);
+    free(bparent);
+    free(fdist);
+    free(bdist);
+    return result;
+}
+
+#endif
@@ -0,0 +1,127 @@
+#ifndef DISTCACHE_H
+#define DISTCACHE_H
+
+#include "utils.h"
+#include <stdatomic.h>
+#include <string.h>
+
+/**
+ * distcache.h
+ * hop distances found so far, the answers of distance and reachability
+ * queries. a fixed table of 12 byte slots: (i, j) packed into one key and
+ * the distance (-1: unreachable) in a parallel array. a key may sit in any
+ * of the DISTANCE_WAYS slots of its set; a full set overwrites the slot
+ * its hash picks, so the table never grows nor allocates after creation.
+ * sets are locked in DISTANCE_STRIPES stripes.
+ * @see server.c
+ **/
+
+#define DISTANCE_SLOTS (1 << 16) // 768 KB.
+#define DISTANCE_WAYS 4
+#define DISTANCE_STRIPES 64
+#define DISTANCE_EMPTY 0UL
+
+struct DistanceCache
+{
+    unsigned long *keys; // ((i << 32) | j) + 1, DISTANCE_EMPTY if free.
+    int *dist;
+    pthread_mutex_t locks[DISTANCE_STRIPES];
+    atomic_long entries;
+};
+
+unsigned long distance_key(int i, int j)
+{
+    return (((unsigned long)(unsigned int)i << 32) | (unsigned int)j) + 1;
+}
+
+/* first slot of the set of key, and the stripe locking it. */
+long distance_set(unsigned long key, int *stripe)
+{
+    unsigned long h = key * 0x9e3779b97f4a7c15UL;
+    long set = (h >> 32) % (DISTANCE_SLOTS / DISTANCE_WAYS);
+    *stripe = set % DISTANCE_STRIPES;
+    return set * DISTANCE_WAYS;
+}
+
+struct DistanceCache *create_distance_cache()
+{
+    struct DistanceCache *cache = (struct DistanceCache *)xmalloc(sizeof(struct DistanceCache));
+    cache->keys = (unsigned long *)xmalloc(sizeof(unsigned long) * DISTANCE_SLOTS);
+    cache->dist = (int *)xmalloc(sizeof(int) * DISTANCE_SLOTS);
+    memset(cache->keys, 0, sizeof(unsigned long) * DISTANCE_SLOTS);
+    for (int s = 0; s < DISTANCE_STRIPES; s++)
+        pthread_mutex_init(&cache->locks[s], NULL);
+    atomic_init(&cache->entries, 0);
+    return cache;
+}
+
+/* TRUE and the distance into *dist if (i, j) is cached. */
+int get_distance(struct DistanceCache *cache, int i, int j, int *dist)
+{
+    int stripe, found = FALSE;
+    unsigned long key = distance_key(i, j);
+    long first = distance_set(key, &stripe);
+    pthread_mutex_lock(&cache->locks[stripe]);
+    for (long s = first; s < first + DISTANCE_WAYS; s++)
+        if (cache->keys[s] == key)
+        {
+            *dist = cache->dist[s];
+            found = TRUE;
+            break;
+        }
+    pthread_mutex_unlock(&cache->locks[stripe]);
+    return found;
+}
+
+void put_distance(struct DistanceCache *cache, int i, int j, int dist)
+{
+    int stripe;
+    unsigned long key = distance_key(i, j);
+    long first = distance_set(key, &stripe);
+    long victim = -1;
+    pthread_mutex_lock(&cache->locks[stripe]);
+    for (long s = first; s < first + DISTANCE_WAYS && victim == -1; s++)
+        if (cache->keys[s] == key)
+            victim = s;
+    for (long s = first; s < first + DISTANCE_WAYS && victim == -1; s++)
+        if (cache->keys[s] == DISTANCE_EMPTY)
+            victim = s;
+    if (victim == -1) // a full set, the hash picks who goes.
+        victim = first + (key * 0x9e3779b97f4a7c15UL) % DISTANCE_WAYS;
+    if (cache->keys[victim] == DISTANCE_EMPTY)
+        atomic_fetch_add_explicit(&cache->entries, 1, memory_order_relaxed);
+    cache->keys[victim] = key;
+    cache->dist[victim] = dist;
+    pthread_mutex_unlock(&cache->locks[stripe]);
+}
+
+/* removes every entry stale() returns TRUE for, returns how many. */
+int evict_distances_if(struct DistanceCache *cache, int (*stale)(int i, int j, int dist, void *arg), void *arg)
+{
+    int evicted = 0;
+    for (long s = 0; s < DISTANCE_SLOTS; s++)
+    {
+        if (s % DISTANCE_WAYS == 0)
+            pthread_mutex_lock(&cache->locks[s / DISTANCE_WAYS % DISTANCE_STRIPES]);
+        unsigned long key = cache->keys[s];
+        if (key != DISTANCE_EMPTY && stale((int)((key - 1) >> 32), (int)((key - 1) & 0xFFFFFFFFUL), cache->dist[s], arg))
+        {
+            cache->keys[s] = DISTANCE_EMPTY;
+            evicted++;
+        }
+        if (s % DISTANCE_WAYS == DISTANCE_WAYS - 1)
+            pthread_mutex_unlock(&cache->locks[s / DISTANCE_WAYS % DISTANCE_STRIPES]);
+    }
+    atomic_fetch_sub_explicit(&cache->entries, evicted, memory_order_relaxed);
+    return evicted;
+}
+
+void destroy_distance_cache(struct DistanceCache *cache)
+{
+    for (int s = 0; s < DISTANCE_STRIPES; s++)
+        pthread_mutex_destroy(&cache->locks[s]);
+    free(cache->keys);
+    free(cache->dist);
+}
+
+#endif
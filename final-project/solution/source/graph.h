@@ -3,6 +3,10 @@
 #define GRAPH_H
 #include "utils.h"
 #include "queue.h"
+#include "bitset.h"
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
 
 /**
  * graph.h
@@ -10,9 +14,48 @@
  * @see server.c
  **/
 
+/* literals regarding to graph input */
+#define NEWLINE_DELIMETER "\n"
+#define COMMENT_DELIMETER '#'
+#define TAB_DELIMETER '\t'
+
+#define CANCEL_CHECK_VERTICES 1024 // expanded between two looks at the deadline.
+
+/* work done by a search, filled by the BFS variants when asked for. with a
+ * deadline the search also gives up once it passes or the peer of watch_fd
+ * hangs up: it sets cancelled and returns as if there was no path. */
+struct SearchStats
+{
+    long vertices; // vertices expanded.
+    long edges;    // adjacency entries scanned.
+    long deadline; // monotonic_us() to give up at, 0 searches to the end.
+    int watch_fd;  // client waiting for the answer, -1 for none.
+    int cancelled;
+};
+
+/* looks at the clock and the socket right away. */
+int search_expired(struct SearchStats *stats)
+{
+    if (stats == NULL || stats->deadline == 0)
+        return FALSE;
+    if (!stats->cancelled)
+        stats->cancelled = monotonic_us() >= stats->deadline ||
+                           (stats->watch_fd >= 0 && peer_closed(stats->watch_fd));
+    return stats->cancelled;
+}
+
+/* search_expired() once every CANCEL_CHECK_VERTICES, called after counting a vertex. */
+int search_cancelled(struct SearchStats *stats)
+{
+    if (stats == NULL || stats->deadline == 0)
+        return FALSE;
+    return stats->cancelled || (stats->vertices % CANCEL_CHECK_VERTICES == 0 && search_expired(stats));
+}
+
 struct AdjacencyNode
 {
     int vertex;
+    int weight; // third column of the input, 1 if there is none.
     struct AdjacencyNode *next;
 };
 
@@ -21,12 +64,16 @@ struct Graph
     int V;
     struct AdjacencyNode **list;
     int *visited;
+    struct AdjacencyNode *pool; // nodes of relabel_graph() in one block, NULL if malloc'd one by one.
+    long pool_size;             // later add_edge() nodes are malloc'd outside of it.
+    int weighted;               // some edge weighs other than 1.
 };
 
 struct AdjacencyNode *create_graph_node(int v)
 {
     struct AdjacencyNode *node = (struct AdjacencyNode *)xmalloc(sizeof(struct AdjacencyNode));
     node->vertex = v;
+    node->weight = 1;
     node->next = NULL;
     return node;
 }
@@ -37,6 +84,9 @@ struct Graph *create_graph(int V)
     graph->V = V;
     graph->list = (struct AdjacencyNode **)xmalloc(V * sizeof(struct AdjacencyNode *));
     graph->visited = (int *)xmalloc(sizeof(int) * V);
+    graph->pool = NULL;
+    graph->pool_size = 0;
+    graph->weighted = FALSE;
 
     for (int i = 0; i < V; i++)
     {
@@ -47,32 +97,219 @@ struct Graph *create_graph(int V)
     return graph;
 }
 
-void add_edge(struct Graph *graph, int i, int j)
+void add_weighted_edge(struct Graph *graph, int i, int j, int weight)
 {
     struct AdjacencyNode *node = create_graph_node(j);
+    node->weight = weight;
+    graph->weighted |= weight != 1;
 
     /* connect new node to rest of the neighbours */
     node->next = graph->list[i];
     graph->list[i] = node;
 }
 
-void delete_graph_node(struct AdjacencyNode *node)
+void add_edge(struct Graph *graph, int i, int j)
+{
+    add_weighted_edge(graph, i, j, 1);
+}
+
+int in_pool(struct Graph *graph, struct AdjacencyNode *node)
+{
+    return graph->pool != NULL && node >= graph->pool && node < graph->pool + graph->pool_size;
+}
+
+/* unlinks one i->j edge, returns FALSE if there is none. */
+int remove_edge(struct Graph *graph, int i, int j)
+{
+    for (struct AdjacencyNode **link = &graph->list[i]; *link != NULL; link = &(*link)->next)
+        if ((*link)->vertex == j)
+        {
+            struct AdjacencyNode *node = *link;
+            *link = node->next;
+            if (!in_pool(graph, node))
+                free(node);
+            return TRUE;
+        }
+    return FALSE;
+}
+
+void delete_graph_node(struct Graph *graph, struct AdjacencyNode *node)
 {
     while (node != NULL)
     {
-        delete_graph_node(node->next);
-        free(node);
+        struct AdjacencyNode *next = node->next;
+        if (!in_pool(graph, node))
+            free(node);
+        node = next;
     }
 }
 
 void destroy_graph(struct Graph *graph)
 {
     for (int i = 0; i < graph->V; i++)
-        delete_graph_node(graph->list[i]);
+        delete_graph_node(graph, graph->list[i]);
+    free(graph->pool);
     free(graph->visited);
     free(graph->list);
 }
 
+/* graph with every edge turned around, for searches from the target. */
+struct Graph *reverse_graph(struct Graph *graph)
+{
+    struct Graph *reverse = create_graph(graph->V);
+    for (int i = 0; i < graph->V; i++)
+        for (struct AdjacencyNode *node = graph->list[i]; node != NULL; node = node->next)
+            add_weighted_edge(reverse, node->vertex, i, node->weight);
+    return reverse;
+}
+
+/* copy of graph with its adjacency nodes in one block, every list in the
+ * same order so that searches over either find the same paths. */
+struct Graph *copy_graph(struct Graph *graph)
+{
+    long E = 0;
+    for (int v = 0; v < graph->V; v++)
+        for (struct AdjacencyNode *adj = graph->list[v]; adj != NULL; adj = adj->next)
+            E++;
+    struct Graph *copy = create_graph(graph->V);
+    copy->pool = (struct AdjacencyNode *)xmalloc(sizeof(struct AdjacencyNode) * (E + 1));
+    copy->pool_size = E;
+    copy->weighted = graph->weighted;
+    long n = 0;
+    for (int v = 0; v < graph->V; v++)
+    {
+        copy->list[v] = graph->list[v] != NULL ? &copy->pool[n] : NULL;
+        for (struct AdjacencyNode *adj = graph->list[v]; adj != NULL; adj = adj->next, n++)
+        {
+            copy->pool[n].vertex = adj->vertex;
+            copy->pool[n].weight = adj->weight;
+            copy->pool[n].next = adj->next != NULL ? &copy->pool[n + 1] : NULL;
+        }
+    }
+    return copy;
+}
+
+/* the whole file at fd, '\0' terminated, and closes fd. -1 if it cannot be read whole. */
+int read_raw(int fd, char **raw)
+{
+    *raw = NULL;
+    off_t file_size = lseek(fd, 0, SEEK_END); // learn the size of the file.
+    if (file_size == -1 || file_size >= INT_MAX || lseek(fd, 0, SEEK_SET) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+    *raw = (char *)xmalloc(file_size + 1);
+    off_t done = 0;
+    ssize_t n = 1;
+    while (done < file_size && (n = read(fd, *raw + done, file_size - done)) > 0)
+        done += n;
+    close(fd);
+    if (done < file_size) // a read error, or it shrunk while being read.
+        return -1;
+    (*raw)[file_size] = '\0';
+    return file_size;
+}
+
+int is_comment(const char *line)
+{
+    return line[0] == COMMENT_DELIMETER;
+}
+
+/* a decimal field of a line into *value, FALSE if there are no digits or it
+ * is out of [min, INT_MAX - 1], so that an id + 1 still fits an int. */
+int parse_field(const char *p, long min, int *value)
+{
+    char *end;
+    errno = 0;
+    long n = strtol(p, &end, 10);
+    if (end == p || errno != 0 || n < min || n >= INT_MAX)
+        return FALSE;
+    *value = (int)n;
+    return TRUE;
+}
+
+/* the "i<TAB>j" or "i<TAB>j<TAB>weight" line starting at line, which ends at
+ * '\n' or '\0'. 1 for an edge, 0 for a comment or a line without a tab, -1
+ * if a field is no number or out of range. weights below 0 are read as 1. */
+int parse_edge(const char *line, int *i, int *j, int *weight)
+{
+    const char *second = line + strcspn(line, "\t\n");
+    if (is_comment(line) || *second != TAB_DELIMETER)
+        return 0;
+    const char *third = second + 1 + strcspn(second + 1, "\t\n");
+    *weight = 1;
+    if (!parse_field(line, 0, i) || !parse_field(second + 1, 0, j) ||
+        (*third == TAB_DELIMETER && !parse_field(third + 1, INT_MIN, weight)))
+        return -1;
+    if (*weight < 0)
+        *weight = 1;
+    return 1;
+}
+
+/* the line after the one at p, NULL after the last one. */
+const char *next_line(const char *p)
+{
+    p = strchr(p, '\n');
+    return p != NULL ? p + 1 : NULL;
+}
+
+/* finds the number of vertices of the graph, -1 with *bad set to the number
+ * of the first malformed line if there is one. */
+int find_V(const char *raw, int *bad)
+{
+    const char *p = raw;
+    int V = 0, line = 1;
+    for (; p != NULL && *p != '\0'; line++)
+    {
+        int i, j, weight, parsed = parse_edge(p, &i, &j, &weight);
+        if (parsed == -1)
+        {
+            *bad = line;
+            return -1;
+        }
+        if (parsed == 1 && i > V)
+            V = i;
+        if (parsed == 1 && j > V)
+            V = j;
+        p = next_line(p);
+    }
+    return V + 1;
+}
+
+/* builds the graph from an edge list file, one "i<TAB>j" or "i<TAB>j<TAB>weight"
+ * per line, and closes fd. lines without a tab are skipped. NULL if the file
+ * cannot be read or a line is malformed, *edge_count is then the number of
+ * that line, 0 for the file as a whole. nothing in it exits the process, a
+ * bad file on reload leaves the serving graph alone. */
+struct Graph *load_graph(int fd, int *edge_count)
+{
+    char *raw;
+    *edge_count = 0;
+    int V;
+    if (read_raw(fd, &raw) == -1 || (V = find_V(raw, edge_count)) == -1)
+    {
+        free(raw);
+        return NULL;
+    }
+    struct Graph *graph = create_graph(V);
+
+    char *token = strtok(raw, NEWLINE_DELIMETER);
+    while (token != NULL) // walk through lines, find_V checked them all.
+    {
+        int i, j, weight;
+        if (parse_edge(token, &i, &j, &weight) == 1)
+        {
+            add_weighted_edge(graph, i, j, weight);
+            (*edge_count)++;
+        }
+        token = strtok(NULL, NEWLINE_DELIMETER);
+    }
+
+    free(raw);
+    return graph;
+}
+
 int edge(struct Graph *graph, int i, int j)
 {
     struct AdjacencyNode *node = graph->list[i];
@@ -85,7 +322,8 @@ int edge(struct Graph *graph, int i, int j)
     return FALSE;
 }
 
-struct Queue *BFS(struct Graph *graph, int start, int end)
+/* the straightforward BFS, every frontier entry carries a copy of its whole path. */
+struct Queue *bfs_paths(struct Graph *graph, int start, int end, struct SearchStats *stats)
 {
     if (start == end) // source and dest given as the same.
     {
@@ -124,8 +362,12 @@ struct Queue *BFS(struct Graph *graph, int start, int end)
 
         struct AdjacencyNode *adj = graph->list[node];
         visited[node] = TRUE;
+        if (stats != NULL)
+            stats->vertices++;
         while (adj != NULL)
         {
+            if (stats != NULL)
+                stats->edges++;
             if (visited[adj->vertex])
                 adj = adj->next;
             else
@@ -151,8 +393,328 @@ struct Queue *BFS(struct Graph *graph, int start, int end)
     }
     destroy_queue(paths);
     free(paths);
+    free(visited);
 
     return found ? path : NULL;
 }
 
+/* path start..end out of a parent array, parent[start] == start. */
+struct Queue *trace_path(int *parent, int start, int end, int V)
+{
+    int length = 1;
+    for (int v = end; v != start; v = parent[v])
+        length++;
+
+    int *reversed = (int *)xmalloc(sizeof(int) * length);
+    int n = 0;
+    for (int v = end; v != start; v = parent[v])
+        reversed[n++] = v;
+    reversed[n++] = start;
+
+    struct Queue *result = create_queue(V < length ? length : V);
+    while (n > 0)
+        enqueue(&result, reversed[--n]);
+    free(reversed);
+    return result;
+}
+
+/* BFS keeping one parent per vertex, stops as soon as end is discovered. */
+struct Queue *bfs_parent(struct Graph *graph, int start, int end, struct SearchStats *stats)
+{
+    int *parent = (int *)xmalloc(sizeof(int) * graph->V);
+    int *frontier = (int *)xmalloc(sizeof(int) * graph->V);
+    for (int i = 0; i < graph->V; i++)
+        parent[i] = -1;
+
+    int head = 0, tail = 0;
+    parent[start] = start;
+    frontier[tail++] = start;
+    while (head < tail && parent[end] == -1)
+    {
+        int node = frontier[head++];
+        if (stats != NULL)
+            stats->vertices++;
+        if (search_cancelled(stats))
+            break;
+        for (struct AdjacencyNode *adj = graph->list[node]; adj != NULL; adj = adj->next)
+        {
+            if (stats != NULL)
+                stats->edges++;
+            if (parent[adj->vertex] == -1)
+            {
+                parent[adj->vertex] = node;
+                frontier[tail++] = adj->vertex;
+                if (adj->vertex == end)
+                    break;
+            }
+        }
+    }
+
+    struct Queue *result = parent[end] == -1 ? NULL : trace_path(parent, start, end, graph->V);
+    free(parent);
+    free(frontier);
+    return result;
+}
+
+/* expands one whole level of a bidirectional search, returns the meeting
+ * vertex closest to the other end, or -1. */
+int expand_level(struct Graph *graph, int *frontier, int *head, int *tail,
+                 int *parent, int *dist, int *other_dist, struct SearchStats *stats)
+{
+    int level_end = *tail;
+    int meet = -1;
+    while (*head < level_end)
+    {
+        int node = frontier[(*head)++];
+        if (stats != NULL)
+            stats->vertices++;
+        for (struct AdjacencyNode *adj = graph->list[node]; adj != NULL; adj = adj->next)
+        {
+            if (stats != NULL)
+                stats->edges++;
+            if (parent[adj->vertex] != -1)
+                continue;
+            parent[adj->vertex] = node;
+            dist[adj->vertex] = dist[node] + 1;
+            frontier[(*tail)++] = adj->vertex;
+            if (other_dist[adj->vertex] != -1 && (meet == -1 || other_dist[adj->vertex] < other_dist[meet]))
+                meet = adj->vertex;
+        }
+    }
+    return meet;
+}
+
+/* BFS from both ends at once, always growing the smaller frontier. reverse
+ * must be reverse_graph(graph). expanding whole levels keeps the result hop
+ * minimal. */
+struct Queue *bfs_bidirectional(struct Graph *graph, struct Graph *reverse, int start, int end,
+                                struct SearchStats *stats)
+{
+    if (start == end)
+        return bfs_parent(graph, start, end, stats);
+
+    int V = graph->V;
+    int *fparent = (int *)xmalloc(sizeof(int) * V), *bparent = (int *)xmalloc(sizeof(int) * V);
+    int *fdist = (int *)xmalloc(sizeof(int) * V), *bdist = (int *)xmalloc(sizeof(int) * V);
+    int *ffrontier = (int *)xmalloc(sizeof(int) * V), *bfrontier = (int *)xmalloc(sizeof(int) * V);
+    for (int i = 0; i < V; i++)
+        fparent[i] = bparent[i] = fdist[i] = bdist[i] = -1;
+
+    int fhead = 0, ftail = 0, bhead = 0, btail = 0, meet = -1;
+    fparent[start] = start;
+    fdist[start] = 0;
+    ffrontier[ftail++] = start;
+    bparent[end] = end;
+    bdist[end] = 0;
+    bfrontier[btail++] = end;
+    while (meet == -1 && fhead < ftail && bhead < btail)
+    {
+        if (ftail - fhead <= btail - bhead)
+            meet = expand_level(graph, ffrontier, &fhead, &ftail, fparent, fdist, bdist, stats);
+        else
+            meet = expand_level(reverse, bfrontier, &bhead, &btail, bparent, bdist, fdist, stats);
+    }
+
+    struct Queue *result = NULL;
+    if (meet != -1)
+    {
+        // forward half up to the meeting vertex, then follow bparent towards end.
+        result = trace_path(fparent, start, meet, V);
+        for (int v = meet; v != end;)
+        {
+            v = bparent[v];
+            enqueue(&result, v);
+        }
+    }
+    free(fparent);
+    free(bparent);
+    free(fdist);
+    free(bdist);
+    free(ffrontier);
+    free(bfrontier);
+    return result;
+}
+
+/* hops from start to every vertex, -1 where it cannot reach. */
+int *bfs_distances(struct Graph *graph, int start)
+{
+    int *dist = (int *)xmalloc(sizeof(int) * graph->V);
+    int *frontier = (int *)xmalloc(sizeof(int) * graph->V);
+    for (int i = 0; i < graph->V; i++)
+        dist[i] = -1;
+    int head = 0, tail = 0;
+    dist[start] = 0;
+    frontier[tail++] = start;
+    while (head < tail)
+    {
+        int node = frontier[head++];
+        for (struct AdjacencyNode *adj = graph->list[node]; adj != NULL; adj = adj->next)
+            if (dist[adj->vertex] == -1)
+            {
+                dist[adj->vertex] = dist[node] + 1;
+                frontier[tail++] = adj->vertex;
+            }
+    }
+    free(frontier);
+    return dist;
+}
+
+/* hops from start to end, -1 if it cannot reach. a bitset visited set and
+ * the level boundaries in the frontier are all it keeps, no parents. */
+int bfs_hops(struct Graph *graph, int start, int end, struct SearchStats *stats)
+{
+    if (start == end)
+        return 0;
+    unsigned long *visited = create_bitset(graph->V);
+    int *frontier = (int *)xmalloc(sizeof(int) * graph->V);
+    int head = 0, tail = 0, depth = 0, hops = -1;
+    bitset_set(visited, start);
+    frontier[tail++] = start;
+    while (hops == -1 && head < tail && !search_cancelled(stats))
+    {
+        int level_end = tail;
+        depth++;
+        while (hops == -1 && head < level_end)
+        {
+            int node = frontier[head++];
+            if (stats != NULL)
+                stats->vertices++;
+            if (search_cancelled(stats))
+                break;
+            for (struct AdjacencyNode *adj = graph->list[node]; adj != NULL; adj = adj->next)
+            {
+                if (stats != NULL)
+                    stats->edges++;
+                if (!bitset_test_and_set(visited, adj->vertex))
+                    continue;
+                if (adj->vertex == end)
+                {
+                    hops = depth;
+                    break;
+                }
+                frontier[tail++] = adj->vertex;
+            }
+        }
+    }
+    free(visited);
+    free(frontier);
+    return hops;
+}
+
+/* one level of bfs_bitmap(), kept to recover the path: a vertex list while
+ * it is small, a bitset once the list would take more memory. */
+struct Level
+{
+    int count, cap;
+    int *list;           // NULL when dense.
+    unsigned long *bits; // NULL when sparse.
+};
+
+void level_add(struct Level *level, int v, int V)
+{
+    level->count++;
+    if (level->bits != NULL)
+    {
+        bitset_set(level->bits, v);
+        return;
+    }
+    if (level->count > level->cap)
+    {
+        level->cap = level->cap * 2 + 16;
+        level->list = (int *)xrealloc(level->list, sizeof(int) * level->cap);
+    }
+    level->list[level->count - 1] = v;
+    if ((long)level->count * 32 > V) // the bitset is smaller from now on.
+    {
+        level->bits = create_bitset(V);
+        for (int i = 0; i < level->count; i++)
+            bitset_set(level->bits, level->list[i]);
+        free(level->list);
+        level->list = NULL;
+    }
+}
+
+/* i-th member walk: first call with *i = -1, returns -1 at the end. */
+int level_next(struct Level *level, int *i, int V)
+{
+    if (level->bits != NULL)
+        return *i = bitset_next(level->bits, V, *i + 1);
+    return ++(*i) < level->count ? level->list[*i] : -1;
+}
+
+/* BFS with a bitset visited set and levels that switch to bitsets when
+ * wide, no per vertex parent. the path is recovered by walking the levels
+ * back from end, looking for a predecessor of each vertex in the level before. */
+struct Queue *bfs_bitmap(struct Graph *graph, int start, int end, struct SearchStats *stats)
+{
+    int V = graph->V, depth = 0, levels_cap = 16, found = start == end;
+    unsigned long *visited = create_bitset(V);
+    struct Level *levels = (struct Level *)xmalloc(sizeof(struct Level) * levels_cap);
+    levels[0] = (struct Level){0, 0, NULL, NULL};
+    level_add(&levels[0], start, V);
+    bitset_set(visited, start);
+
+    while (!found && levels[depth].count > 0 && !search_cancelled(stats))
+    {
+        if (depth + 1 == levels_cap)
+            levels = (struct Level *)xrealloc(levels, sizeof(struct Level) * (levels_cap *= 2));
+        struct Level *next = &levels[depth + 1];
+        *next = (struct Level){0, 0, NULL, NULL};
+        int i = -1, node;
+        while (!found && (node = level_next(&levels[depth], &i, V)) != -1)
+        {
+            if (stats != NULL)
+                stats->vertices++;
+            if (search_cancelled(stats))
+                break;
+            for (struct AdjacencyNode *adj = graph->list[node]; adj != NULL; adj = adj->next)
+            {
+                if (stats != NULL)
+                    stats->edges++;
+                if (!bitset_test_and_set(visited, adj->vertex))
+                    continue;
+                level_add(next, adj->vertex, V);
+                if (adj->vertex == end)
+                {
+                    found = TRUE;
+                    break;
+                }
+            }
+        }
+        depth++;
+    }
+
+    struct Queue *result = NULL;
+    if (found)
+    {
+        int *path = (int *)xmalloc(sizeof(int) * (depth + 1));
+        path[depth] = end;
+        for (int k = depth - 1; k >= 0; k--)
+        {
+            int i = -1, u;
+            while ((u = level_next(&levels[k], &i, V)) != -1 && !edge(graph, u, path[k + 1]))
+                ;
+            path[k] = u;
+        }
+        result = create_queue(depth + 1);
+        for (int k = 0; k <= depth; k++)
+            enqueue(&result, path[k]);
+        free(path);
+    }
+
+    for (int k = 0; k <= depth; k++)
+    {
+        free(levels[k].list);
+        free(levels[k].bits);
+    }
+    free(levels);
+    free(visited);
+    return result;
+}
+
+struct Queue *BFS(struct Graph *graph, int start, int end)
+{
+    return bfs_bitmap(graph, start, end, NULL);
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,257 @@
+#ifndef LANDMARK_H
+#define LANDMARK_H
+
+#include "utils.h"
+#include "graph.h"
+#include "compressed.h"
+#include <limits.h>
+
+/**
+ * landmark.h
+ * optional distance labels to and from k landmarks (the highest degree
+ * vertices), 4 bytes per vertex and landmark. by the triangle inequality
+ * they give, for any pair, a proof of unreachability or a lower bound on
+ * the hop distance, and an upper bound through the best landmark. the
+ * bounds prune a bidirectional BFS (ALT style): a vertex whose depth plus
+ * lower bound to the other end exceeds the upper bound is not expanded.
+ * @see server.c
+ **/
+
+#define LANDMARK_INF 0xFFFF // landmark and vertex are not connected that way.
+#define LANDMARK_FAR 0xFFFE // connected but too far to store, no bounds from it.
+#define LANDMARK_UNREACHABLE INT_MAX
+
+struct LandmarkIndex
+{
+    int k, V;
+    int *landmarks;
+    unsigned short *to;   // to[v * k + i]: hops from v to landmark i.
+    unsigned short *from; // from[v * k + i]: hops from landmark i to v.
+};
+
+/* BFS from root, stores hop counts into dist[v * k + i]. */
+void landmark_bfs(const struct Adjacency *graph, int root, unsigned short *dist, int k, int i, int *frontier)
+{
+    int head = 0, tail = 0;
+    dist[(long)root * k + i] = 0;
+    frontier[tail++] = root;
+    while (head < tail)
+    {
+        int node = frontier[head++], w;
+        int d = dist[(long)node * k + i];
+        struct Cursor it;
+        for (cursor_begin(graph, node, &it); cursor_next(graph, &it, &w);)
+        {
+            unsigned short *next = &dist[(long)w * k + i];
+            if (*next != LANDMARK_INF)
+                continue;
+            *next = d + 1 < LANDMARK_FAR ? d + 1 : LANDMARK_FAR;
+            frontier[tail++] = w;
+        }
+    }
+}
+
+/* picks the k highest degree vertices, reverse must be reverse_adjacency(graph). */
+struct LandmarkIndex *build_landmark_index(const struct Adjacency *graph, const struct Adjacency *reverse, int k)
+{
+    int V = graph->V;
+    k = k < V ? k : V;
+    struct LandmarkIndex *index = (struct LandmarkIndex *)xmalloc(sizeof(struct LandmarkIndex));
+    index->k = k;
+    index->V = V;
+    index->landmarks = (int *)xmalloc(sizeof(int) * (k + 1));
+    index->to = (unsigned short *)xmalloc(sizeof(unsigned short) * ((long)V * k + 1));
+    index->from = (unsigned short *)xmalloc(sizeof(unsigned short) * ((long)V * k + 1));
+
+    int *degree = (int *)xmalloc(sizeof(int) * V), w;
+    struct Cursor it;
+    for (int v = 0; v < V; v++)
+    {
+        degree[v] = 0;
+        for (cursor_begin(graph, v, &it); cursor_next(graph, &it, &w);)
+            degree[v]++;
+        for (cursor_begin(reverse, v, &it); cursor_next(reverse, &it, &w);)
+            degree[v]++;
+    }
+    for (int i = 0; i < k; i++)
+    {
+        int best = -1;
+        for (int v = 0; v < V; v++)
+            if (degree[v] >= 0 && (best == -1 || degree[v] > degree[best]))
+                best = v;
+        index->landmarks[i] = best;
+        degree[best] = -1; // taken.
+    }
+    free(degree);
+
+    for (long j = 0; j < (long)V * k; j++)
+        index->to[j] = index->from[j] = LANDMARK_INF;
+    int *frontier = (int *)xmalloc(sizeof(int) * V);
+    for (int i = 0; i < k; i++)
+    {
+        landmark_bfs(graph, index->landmarks[i], index->from, k, i, frontier);
+        landmark_bfs(reverse, index->landmarks[i], index->to, k, i, frontier);
+    }
+    free(frontier);
+    return index;
+}
+
+long landmark_bytes(struct LandmarkIndex *index)
+{
+    return 2 * sizeof(unsigned short) * (long)index->V * index->k;
+}
+
+/* lower bound on the hops from u to v, LANDMARK_UNREACHABLE if there is no path. */
+int landmark_lower(struct LandmarkIndex *index, int u, int v)
+{
+    int k = index->k, best = 0;
+    unsigned short *tu = &index->to[(long)u * k], *tv = &index->to[(long)v * k];
+    unsigned short *fu = &index->from[(long)u * k], *fv = &index->from[(long)v * k];
+    for (int i = 0; i < k; i++)
+    {
+        // the landmark reaches u but not v, or v reaches it but u does not.
+        if ((fu[i] != LANDMARK_INF && fv[i] == LANDMARK_INF) || (tv[i] != LANDMARK_INF && tu[i] == LANDMARK_INF))
+            return LANDMARK_UNREACHABLE;
+        if (fu[i] < LANDMARK_FAR && fv[i] < LANDMARK_FAR && fv[i] - fu[i] > best)
+            best = fv[i] - fu[i];
+        if (tu[i] < LANDMARK_FAR && tv[i] < LANDMARK_FAR && tu[i] - tv[i] > best)
+            best = tu[i] - tv[i];
+    }
+    return best;
+}
+
+/* upper bound on the hops from u to v through a landmark, INT_MAX if unknown. */
+int landmark_upper(struct LandmarkIndex *index, int u, int v)
+{
+    int k = index->k, best = INT_MAX;
+    unsigned short *tu = &index->to[(long)u * k], *fv = &index->from[(long)v * k];
+    for (int i = 0; i < k; i++)
+        if (tu[i] < LANDMARK_FAR && fv[i] < LANDMARK_FAR && tu[i] + fv[i] < best)
+            best = tu[i] + fv[i];
+    return best;
+}
+
+int landmark_unreachable(struct LandmarkIndex *index, int u, int v)
+{
+    return landmark_lower(index, u, v) == LANDMARK_UNREACHABLE;
+}
+
+/* TRUE if adding the edge u->v shortens some label, the index is stale then. */
+int landmark_shortens(struct LandmarkIndex *index, int u, int v)
+{
+    int k = index->k;
+    unsigned short *tu = &index->to[(long)u * k], *tv = &index->to[(long)v * k];
+    unsigned short *fu = &index->from[(long)u * k], *fv = &index->from[(long)v * k];
+    for (int i = 0; i < k; i++)
+    {
+        if (fu[i] != LANDMARK_INF && (fv[i] == LANDMARK_INF || (fu[i] < LANDMARK_FAR && fu[i] + 1 < fv[i])))
+            return TRUE;
+        if (tv[i] != LANDMARK_INF && (tu[i] == LANDMARK_INF || (tv[i] < LANDMARK_FAR && tv[i] + 1 < tu[i])))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/* TRUE if a vertex at depth hops from its search's root cannot be on a
+ * path of at most bound hops, lower is its bound towards the other end. */
+int landmark_prune(int depth, int lower, int bound)
+{
+    return lower == LANDMARK_UNREACHABLE || (bound != INT_MAX && depth + lower > bound);
+}
+
+/* expand_level() of graph.h, skipping vertices the labels rule out. forward
+ * searches bound towards end, backward ones from start. */
+int landmark_expand(struct Graph *graph, struct LandmarkIndex *index, int forward, int start, int end, int bound,
+                    int *frontier, int *head, int *tail, int *parent, int *dist, int *other_dist,
+                    struct SearchStats *stats)
+{
+    int level_end = *tail;
+    int meet = -1;
+    while (*head < level_end)
+    {
+        int node = frontier[(*head)++];
+        if (stats != NULL)
+            stats->vertices++;
+        if (search_cancelled(stats))
+            return -1;
+        for (struct AdjacencyNode *adj = graph->list[node]; adj != NULL; adj = adj->next)
+        {
+            if (stats != NULL)
+                stats->edges++;
+            int w = adj->vertex;
+            if (parent[w] != -1)
+                continue;
+            int lower = forward ? landmark_lower(index, w, end) : landmark_lower(index, start, w);
+            if (landmark_prune(dist[node] + 1, lower, bound))
+                continue;
+            parent[w] = node;
+            dist[w] = dist[node] + 1;
+            frontier[(*tail)++] = w;
+            if (other_dist[w] != -1 && (meet == -1 || other_dist[w] < other_dist[meet]))
+                meet = w;
+        }
+    }
+    return meet;
+}
+
+/* bfs_bidirectional() guided by the labels, same hop minimal result. */
+struct Queue *landmark_search(struct Graph *graph, struct Graph *reverse, struct LandmarkIndex *index,
+                              int start, int end, struct SearchStats *stats)
+{
+    if (start == end)
+        return bfs_parent(graph, start, end, stats);
+    if (landmark_unreachable(index, start, end))
+        return NULL;
+    int bound = landmark_upper(index, start, end);
+
+    int V = graph->V;
+    int *fparent = (int *)xmalloc(sizeof(int) * V), *bparent = (int *)xmalloc(sizeof(int) * V);
+    int *fdist = (int *)xmalloc(sizeof(int) * V), *bdist = (int *)xmalloc(sizeof(int) * V);
+    int *ffrontier = (int *)xmalloc(sizeof(int) * V), *bfrontier = (int *)xmalloc(sizeof(int) * V);
+    for (int i = 0; i < V; i++)
+        fparent[i] = bparent[i] = fdist[i] = bdist[i] = -1;
+
+    int fhead = 0, ftail = 0, bhead = 0, btail = 0, meet = -1;
+    fparent[start] = start;
+    fdist[start] = 0;
+    ffrontier[ftail++] = start;
+    bparent[end] = end;
+    bdist[end] = 0;
+    bfrontier[btail++] = end;
+    while (meet == -1 && fhead < ftail && bhead < btail && !search_cancelled(stats))
+    {
+        if (ftail - fhead <= btail - bhead)
+            meet = landmark_expand(graph, index, TRUE, start, end, bound, ffrontier, &fhead, &ftail,
+                                   fparent, fdist, bdist, stats);
+        else
+            meet = landmark_expand(reverse, index, FALSE, start, end, bound, bfrontier, &bhead, &btail,
+                                   bparent, bdist, fdist, stats);
+    }
+
+    struct Queue *result = NULL;
+    if (meet != -1)
+    {
+        result = trace_path(fparent, start, meet, V);
+        for (int v = meet; v != end;)
+        {
+            v = bparent[v];
+            enqueue(&result, v);
+        }
+    }
+    free(fparent);
+    free(bparent);
+    free(fdist);
+    free(bdist);
+    free(ffrontier);
+    free(bfrontier);
+    return result;
+}
+
+void destroy_landmark_index(struct LandmarkIndex *index)
+{
+    free(index->landmarks);
+    free(index->to);
+    free(index->from);
+}
+
+#endif
@@ -0,0 +1,301 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include "utils.h"
+#include "ring.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+
+/**
+ * log.h
+ * asynchronous logging. every thread appends its lines to its own single
+ * producer ring, a background writer merges the rings in timestamp order
+ * and hands them to the kernel in large writes. the "[date] " prefix is
+ * formatted by the writer and cached for the current second, so the
+ * request path neither formats dates nor makes syscalls.
+ * @see server.c
+ **/
+
+/* levels, a line is written if its level <= the configured one (-l) */
+#define LOG_ERROR 0
+#define LOG_INFO 1
+#define LOG_DEBUG 2
+
+#define LOG_BUFFER_CAP (1 << 16) // per thread, power of two.
+#define LOG_BATCH (1 << 16)      // bytes handed to a single write.
+#define LOG_LINE_MAX 4096
+#define LOG_FLUSH_MS 50 // writer drains at least this often.
+
+struct LogRecord
+{
+    long stamp; // CLOCK_REALTIME in ns, used to merge the rings.
+    int len;    // message bytes following the header.
+};
+
+struct LogBuffer
+{
+    char *data;
+    atomic_ulong head; // written by the owner thread.
+    char pad[CACHE_LINE];
+    atomic_ulong tail;   // written by the writer thread.
+    unsigned long limit; // head snapshot of the current drain, writer only.
+    atomic_int dead;     // owner exited, freed once drained.
+    struct LogBuffer *next;
+};
+
+struct Logger
+{
+    int fd, level;
+    struct LogBuffer *_Atomic buffers; // threads push themselves, writer unlinks dead ones.
+    pthread_key_t key;
+    pthread_t writer;
+    int running;
+    atomic_int stop;
+    struct Event pending; // producers poke the writer.
+    struct Event drained; // writer pokes producers waiting for space.
+
+    /* writer side */
+    char *batch;
+    int batch_len;
+    time_t cached_sec;
+    char cached_time[40];
+};
+
+struct Logger logger;
+__thread struct LogBuffer *log_buffer = NULL;
+
+void xlog(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+void log_release(void *p)
+{
+    atomic_store(&((struct LogBuffer *)p)->dead, TRUE);
+}
+
+void log_init(int fd, int level)
+{
+    logger.fd = fd;
+    logger.level = level;
+    atomic_init(&logger.buffers, NULL);
+    if ((errno = pthread_key_create(&logger.key, log_release)) != 0)
+        xerror(__func__, "pthread_key_create");
+    logger.running = FALSE;
+    atomic_init(&logger.stop, FALSE);
+    event_init(&logger.pending);
+    event_init(&logger.drained);
+
+    logger.batch = (char *)xmalloc(LOG_BATCH);
+    logger.batch_len = 0;
+    logger.cached_sec = -1;
+}
+
+struct LogBuffer *log_register()
+{
+    struct LogBuffer *b = (struct LogBuffer *)xmalloc(sizeof(struct LogBuffer));
+    b->data = (char *)xmalloc(LOG_BUFFER_CAP);
+    atomic_init(&b->head, 0);
+    atomic_init(&b->tail, 0);
+    atomic_init(&b->dead, FALSE);
+    b->limit = 0;
+
+    b->next = atomic_load(&logger.buffers);
+    while (!atomic_compare_exchange_weak(&logger.buffers, &b->next, b))
+        ;
+    pthread_setspecific(logger.key, b); // marks the buffer dead when the thread exits.
+    return b;
+}
+
+void log_copy_in(struct LogBuffer *b, unsigned long pos, const void *src, int len)
+{
+    unsigned long off = pos & (LOG_BUFFER_CAP - 1);
+    int first = len < (long)(LOG_BUFFER_CAP - off) ? len : (int)(LOG_BUFFER_CAP - off);
+    memcpy(b->data + off, src, first);
+    memcpy(b->data, (const char *)src + first, len - first);
+}
+
+void log_copy_out(struct LogBuffer *b, unsigned long pos, void *dest, int len)
+{
+    unsigned long off = pos & (LOG_BUFFER_CAP - 1);
+    int first = len < (long)(LOG_BUFFER_CAP - off) ? len : (int)(LOG_BUFFER_CAP - off);
+    memcpy(dest, b->data + off, first);
+    memcpy((char *)dest + first, b->data, len - first);
+}
+
+void log_flush_batch()
+{
+    int offset = 0;
+    while (offset < logger.batch_len)
+        offset += xwrite(logger.fd, logger.batch + offset, logger.batch_len - offset);
+    logger.batch_len = 0;
+}
+
+/* appends "[date] message" of the record at b's tail to the batch. */
+void log_format(struct LogBuffer *b, unsigned long tail, struct LogRecord *rec)
+{
+    time_t sec = rec->stamp / 1000000000;
+    if (sec != logger.cached_sec)
+    {
+        char date[32];
+        ctime_r(&sec, date);
+        date[strcspn(date, "\n")] = '\0';
+        snprintf(logger.cached_time, sizeof(logger.cached_time), "[%s] ", date);
+        logger.cached_sec = sec;
+    }
+
+    int prefix = strlen(logger.cached_time);
+    if (logger.batch_len + prefix + rec->len > LOG_BATCH)
+        log_flush_batch();
+    memcpy(logger.batch + logger.batch_len, logger.cached_time, prefix);
+    log_copy_out(b, tail + sizeof(struct LogRecord), logger.batch + logger.batch_len + prefix, rec->len);
+    logger.batch_len += prefix + rec->len;
+}
+
+/* writes out everything logged so far, oldest line first. called by the
+ * writer thread, or by the only thread there is before log_start(). */
+void log_drain()
+{
+    struct LogBuffer *b;
+    for (b = atomic_load(&logger.buffers); b != NULL; b = b->next)
+        b->limit = atomic_load_explicit(&b->head, memory_order_acquire);
+
+    while (TRUE)
+    {
+        struct LogBuffer *oldest = NULL;
+        struct LogRecord rec, oldest_rec;
+        for (b = atomic_load(&logger.buffers); b != NULL; b = b->next)
+        {
+            unsigned long tail = atomic_load_explicit(&b->tail, memory_order_relaxed);
+            if (tail == b->limit)
+                continue;
+            log_copy_out(b, tail, &rec, sizeof(struct LogRecord));
+            if (oldest == NULL || rec.stamp < oldest_rec.stamp)
+            {
+                oldest = b;
+                oldest_rec = rec;
+            }
+        }
+        if (oldest == NULL)
+            break;
+
+        unsigned long tail = atomic_load_explicit(&oldest->tail, memory_order_relaxed);
+        log_format(oldest, tail, &oldest_rec);
+        atomic_store_explicit(&oldest->tail, tail + sizeof(struct LogRecord) + oldest_rec.len,
+                              memory_order_release);
+    }
+    log_flush_batch();
+    event_notify(&logger.drained, INT_MAX);
+
+    // free the rings of exited threads, the list head is left to the producers.
+    struct LogBuffer *prev = atomic_load(&logger.buffers);
+    while (prev != NULL && (b = prev->next) != NULL)
+    {
+        if (atomic_load(&b->dead) && atomic_load(&b->tail) == atomic_load(&b->head))
+        {
+            prev->next = b->next;
+            free(b->data);
+            free(b);
+        }
+        else
+            prev = b;
+    }
+}
+
+void xlog(int level, const char *fmt, ...)
+{
+    if (level > logger.level)
+        return;
+
+    char line[LOG_LINE_MAX];
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(line, LOG_LINE_MAX, fmt, ap);
+    va_end(ap);
+    if (len >= LOG_LINE_MAX) // truncated, keep the line ending.
+    {
+        len = LOG_LINE_MAX - 1;
+        line[len - 1] = '\n';
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    struct LogRecord rec = {now.tv_sec * 1000000000 + now.tv_nsec, len};
+
+    struct LogBuffer *b = log_buffer != NULL ? log_buffer : (log_buffer = log_register());
+    unsigned long need = sizeof(struct LogRecord) + len;
+    unsigned long head = atomic_load_explicit(&b->head, memory_order_relaxed);
+    while (head + need - atomic_load_explicit(&b->tail, memory_order_acquire) > LOG_BUFFER_CAP)
+    {
+        if (!logger.running)
+        {
+            log_drain();
+            continue;
+        }
+        // ring is full, wait for the writer instead of dropping the line.
+        unsigned int seq = event_prepare(&logger.drained);
+        if (head + need - atomic_load(&b->tail) <= LOG_BUFFER_CAP)
+        {
+            event_cancel(&logger.drained);
+            break;
+        }
+        event_notify(&logger.pending, 1);
+        event_wait(&logger.drained, seq);
+    }
+
+    log_copy_in(b, head, &rec, sizeof(struct LogRecord));
+    log_copy_in(b, head + sizeof(struct LogRecord), line, len);
+    atomic_store_explicit(&b->head, head + need, memory_order_release);
+
+    if (level == LOG_ERROR || head + need - atomic_load(&b->tail) > LOG_BUFFER_CAP / 2)
+        event_notify(&logger.pending, 1);
+}
+
+void *log_writer(void *p)
+{
+    (void)p;
+    sigset_t set; // signal handlers may stop the logger, they must not run here.
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    while (!atomic_load(&logger.stop))
+    {
+        unsigned int seq = event_prepare(&logger.pending);
+        event_timedwait(&logger.pending, seq, LOG_FLUSH_MS);
+        log_drain();
+    }
+    return NULL;
+}
+
+/* starts the writer thread, threads do not survive fork so call it after become_daemon(). */
+void log_start()
+{
+    xthread_create(&logger.writer, log_writer, NULL);
+    logger.running = TRUE;
+}
+
+/* in a forked child: what was buffered before the fork is the parent's to
+ * write, skip it and start a writer of our own. */
+void log_after_fork()
+{
+    for (struct LogBuffer *b = atomic_load(&logger.buffers); b != NULL; b = b->next)
+        atomic_store(&b->tail, atomic_load(&b->head));
+    logger.batch_len = 0;
+    atomic_store(&logger.stop, FALSE);
+    log_start();
+}
+
+/* writes out everything that is buffered and stops the writer. */
+void log_stop()
+{
+    if (logger.running)
+    {
+        atomic_store(&logger.stop, TRUE);
+        event_notify(&logger.pending, 1);
+        xthread_join(logger.writer);
+        logger.running = FALSE;
+    }
+    log_drain();
+}
+
+#endif
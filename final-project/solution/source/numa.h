@@ -0,0 +1,116 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#ifndef _GNU_SOURCE // cpu_set_t and the affinity calls, the includer must define it before any header.
+#define _GNU_SOURCE
+#endif
+#include "utils.h"
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+
+/**
+ * numa.h
+ * memory and thread placement over the NUMA nodes the kernel lists under
+ * /sys/devices/system/node, through the set_mempolicy system call itself
+ * so that libnuma is not needed. a policy set in a thread places the pages
+ * it touches first from then on. nodes without cpus are left out, a
+ * machine without the directory is one node holding every cpu.
+ * @see server.c
+ **/
+
+#define NUMA_MAX_NODES 64
+#define NUMA_NODE_DIR "/sys/devices/system/node"
+#ifndef MPOL_DEFAULT // linux/mempolicy.h
+#define MPOL_DEFAULT 0
+#define MPOL_BIND 2
+#define MPOL_INTERLEAVE 3
+#endif
+
+struct NumaTopology
+{
+    int nodes;
+    int id[NUMA_MAX_NODES];         // kernel node number of each node, they may have gaps.
+    cpu_set_t cpus[NUMA_MAX_NODES];
+    int node_of_cpu[CPU_SETSIZE];   // index into id, 0 for cpus seen nowhere.
+};
+
+/* cpus of a "0-3,8-11" list into set, returns how many. */
+int parse_cpulist(const char *list, cpu_set_t *set)
+{
+    CPU_ZERO(set);
+    int count = 0;
+    const char *p = list;
+    while (*p >= '0' && *p <= '9')
+    {
+        char *end;
+        long first = strtol(p, &end, 10), last = first;
+        if (*end == '-')
+            last = strtol(end + 1, &end, 10);
+        for (long c = first; c <= last && c < CPU_SETSIZE; c++, count++)
+            CPU_SET(c, set);
+        p = *end == ',' ? end + 1 : end;
+    }
+    return count;
+}
+
+void numa_topology(struct NumaTopology *t)
+{
+    t->nodes = 0;
+    memset(t->node_of_cpu, 0, sizeof(t->node_of_cpu));
+    for (int n = 0; n < NUMA_MAX_NODES; n++)
+    {
+        char path[64], list[4096];
+        snprintf(path, sizeof(path), NUMA_NODE_DIR "/node%d/cpulist", n);
+        FILE *fp = fopen(path, "r");
+        if (fp == NULL)
+            continue;
+        int read = fgets(list, sizeof(list), fp) != NULL;
+        fclose(fp);
+        if (!read || parse_cpulist(list, &t->cpus[t->nodes]) == 0)
+            continue;
+        for (int c = 0; c < CPU_SETSIZE; c++)
+            if (CPU_ISSET(c, &t->cpus[t->nodes]))
+                t->node_of_cpu[c] = t->nodes;
+        t->id[t->nodes++] = n;
+    }
+    if (t->nodes == 0) // no sysfs, or no node with cpus.
+    {
+        t->id[0] = 0;
+        if (sched_getaffinity(0, sizeof(cpu_set_t), &t->cpus[0]) == -1)
+            CPU_ZERO(&t->cpus[0]);
+        t->nodes = 1;
+    }
+}
+
+/* policy of the calling thread: MPOL_INTERLEAVE over every node, MPOL_BIND
+ * to one, or MPOL_DEFAULT back to local first touch. node is an index into
+ * t->id, ignored unless binding. FALSE if the kernel refuses, e.g. without
+ * NUMA support or under a seccomp filter. */
+int numa_set_policy(struct NumaTopology *t, int mode, int node)
+{
+    unsigned long mask[NUMA_MAX_NODES / (8 * sizeof(unsigned long)) + 1];
+    memset(mask, 0, sizeof(mask));
+    for (int n = 0; n < t->nodes; n++)
+        if (mode == MPOL_INTERLEAVE || (mode == MPOL_BIND && n == node))
+            mask[t->id[n] / (8 * sizeof(unsigned long))] |= 1UL << (t->id[n] % (8 * sizeof(unsigned long)));
+    if (mode == MPOL_DEFAULT)
+        return syscall(SYS_set_mempolicy, MPOL_DEFAULT, NULL, 0) == 0;
+    return syscall(SYS_set_mempolicy, mode, mask, NUMA_MAX_NODES + 1) == 0;
+}
+
+/* keeps the calling thread on the cpus of node. */
+int numa_pin(struct NumaTopology *t, int node)
+{
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &t->cpus[node]) == 0;
+}
+
+/* node of the cpu the calling thread is on right now. */
+int numa_current_node(struct NumaTopology *t)
+{
+    int cpu = sched_getcpu();
+    return cpu >= 0 && cpu < CPU_SETSIZE ? t->node_of_cpu[cpu] : 0;
+}
+
+#endif
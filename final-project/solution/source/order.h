@@ -0,0 +1,219 @@
+#ifndef ORDER_H
+#define ORDER_H
+
+#include "utils.h"
+#include "graph.h"
+#include "compressed.h"
+#include <stdlib.h>
+
+/**
+ * order.h
+ * relabels the vertices of a loaded graph so that vertices visited together
+ * get close ids, and rebuilds it with all adjacency nodes in one block laid
+ * out in the new id order, each list sorted (or reencodes the varint lists). a search then walks memory
+ * mostly forward instead of jumping between scattered mallocs. ids are
+ * translated back with the inverse permutation at the request boundary.
+ * orders (-O): bfs, reverse Cuthill-McKee, decreasing degree.
+ * @see server.c
+ **/
+
+struct VertexKey
+{
+    int key, vertex;
+};
+
+int compare_keys(const void *a, const void *b)
+{
+    const struct VertexKey *x = a, *y = b;
+    if (x->key != y->key)
+        return x->key < y->key ? -1 : 1;
+    return x->vertex - y->vertex;
+}
+
+int compare_nodes(const void *a, const void *b)
+{
+    return ((const struct AdjacencyNode *)a)->vertex - ((const struct AdjacencyNode *)b)->vertex;
+}
+
+/* vertices with their in + out degree as key, sorted ascending. */
+struct VertexKey *sorted_by_degree(const struct Adjacency *graph, const struct Adjacency *reverse)
+{
+    struct VertexKey *keys = (struct VertexKey *)xmalloc(sizeof(struct VertexKey) * graph->V);
+    struct Cursor it;
+    int w;
+    for (int v = 0; v < graph->V; v++)
+    {
+        keys[v].vertex = v;
+        keys[v].key = 0;
+        for (cursor_begin(graph, v, &it); cursor_next(graph, &it, &w);)
+            keys[v].key++;
+        for (cursor_begin(reverse, v, &it); cursor_next(reverse, &it, &w);)
+            keys[v].key++;
+    }
+    qsort(keys, graph->V, sizeof(struct VertexKey), compare_keys);
+    return keys;
+}
+
+/* BFS over the undirected view, roots taken in the order of keys. with rcm
+ * the neighbors of every vertex are visited in increasing degree and the
+ * whole order is reversed at the end. returns the old id of every new id. */
+int *order_traversal(const struct Adjacency *graph, const struct Adjacency *reverse, struct VertexKey *keys, int rcm)
+{
+    int V = graph->V;
+    int *degree = (int *)xmalloc(sizeof(int) * V);
+    for (int i = 0; i < V; i++)
+        degree[keys[i].vertex] = keys[i].key;
+    int *sequence = (int *)xmalloc(sizeof(int) * V);
+    char *seen = (char *)xmalloc(V);
+    for (int v = 0; v < V; v++)
+        seen[v] = FALSE;
+    struct VertexKey *next = (struct VertexKey *)xmalloc(sizeof(struct VertexKey) * V);
+
+    int head = 0, tail = 0;
+    for (int r = 0; r < V; r++)
+    {
+        if (seen[keys[r].vertex])
+            continue;
+        seen[keys[r].vertex] = TRUE;
+        sequence[tail++] = keys[r].vertex;
+        while (head < tail)
+        {
+            int node = sequence[head++], n = 0, w;
+            const struct Adjacency *lists[2] = {graph, reverse};
+            struct Cursor it;
+            for (int l = 0; l < 2; l++)
+                for (cursor_begin(lists[l], node, &it); cursor_next(lists[l], &it, &w);)
+                    if (!seen[w])
+                    {
+                        seen[w] = TRUE;
+                        next[n].key = degree[w];
+                        next[n++].vertex = w;
+                    }
+            if (rcm)
+                qsort(next, n, sizeof(struct VertexKey), compare_keys);
+            for (int i = 0; i < n; i++)
+                sequence[tail++] = next[i].vertex;
+        }
+    }
+
+    if (rcm)
+        for (int i = 0, j = V - 1; i < j; i++, j--)
+        {
+            int t = sequence[i];
+            sequence[i] = sequence[j];
+            sequence[j] = t;
+        }
+    free(degree);
+    free(seen);
+    free(next);
+    return sequence;
+}
+
+/* old id of every new id for the given order, NULL for ORDER_NONE. */
+int *vertex_order(const struct Adjacency *graph, int order)
+{
+    if (order == ORDER_NONE)
+        return NULL;
+    struct Adjacency reverse = reverse_adjacency(graph);
+    struct VertexKey *keys = sorted_by_degree(graph, &reverse);
+    int *sequence;
+    if (order == ORDER_DEGREE)
+    {
+        sequence = (int *)xmalloc(sizeof(int) * graph->V);
+        for (int i = 0; i < graph->V; i++)
+            sequence[i] = keys[graph->V - 1 - i].vertex; // hubs first.
+    }
+    else if (order == ORDER_BFS)
+    {
+        for (int i = 0, j = graph->V - 1; i < j; i++, j--) // roots from the hubs down.
+        {
+            struct VertexKey t = keys[i];
+            keys[i] = keys[j];
+            keys[j] = t;
+        }
+        sequence = order_traversal(graph, &reverse, keys, FALSE);
+    }
+    else
+        sequence = order_traversal(graph, &reverse, keys, TRUE); // roots from the periphery.
+
+    free(keys);
+    destroy_adjacency(&reverse);
+    return sequence;
+}
+
+int *invert_order(int *sequence, int V)
+{
+    int *perm = (int *)xmalloc(sizeof(int) * V);
+    for (int i = 0; i < V; i++)
+        perm[sequence[i]] = i;
+    return perm;
+}
+
+/* copy of graph with vertex v renamed to perm[v] (identity if perm is NULL),
+ * its adjacency nodes in one block in new id order. */
+struct Graph *relabel_graph(struct Graph *graph, int *sequence, int *perm)
+{
+    int V = graph->V;
+    long E = 0;
+    for (int v = 0; v < V; v++)
+        for (struct AdjacencyNode *adj = graph->list[v]; adj != NULL; adj = adj->next)
+            E++;
+
+    struct Graph *relabeled = create_graph(V);
+    relabeled->pool = (struct AdjacencyNode *)xmalloc(sizeof(struct AdjacencyNode) * (E + 1));
+    relabeled->pool_size = E;
+    relabeled->weighted = graph->weighted;
+    long n = 0;
+    for (int v = 0; v < V; v++)
+    {
+        long first = n;
+        for (struct AdjacencyNode *adj = graph->list[sequence ? sequence[v] : v]; adj != NULL; adj = adj->next)
+        {
+            relabeled->pool[n].weight = adj->weight;
+            relabeled->pool[n++].vertex = perm ? perm[adj->vertex] : adj->vertex;
+        }
+        qsort(relabeled->pool + first, n - first, sizeof(struct AdjacencyNode), compare_nodes);
+        for (long i = first; i < n; i++)
+            relabeled->pool[i].next = i + 1 < n ? &relabeled->pool[i + 1] : NULL;
+        relabeled->list[v] = n > first ? &relabeled->pool[first] : NULL;
+    }
+    return relabeled;
+}
+
+/* relabel_graph() for varint lists: the rows are gathered in new id order
+ * and reencoded, the gaps shrink with the span. */
+struct CompressedGraph *relabel_compressed_graph(struct CompressedGraph *cg, int *sequence, int *perm)
+{
+    int V = cg->V, w;
+    struct Neighbors it;
+    long *rows = (long *)xmalloc(sizeof(long) * (V + 1)), n = 0;
+    int *targets = (int *)xmalloc(sizeof(int) * (cg->edges + 1));
+    for (int v = 0; v < V; v++)
+    {
+        rows[v] = n;
+        for (neighbors_begin(cg, sequence[v], &it); neighbors_next(&it, &w);)
+            targets[n++] = perm[w];
+    }
+    rows[V] = n;
+    struct CompressedGraph *relabeled = encode_rows(V, rows, targets, cg->weighted);
+    free(rows);
+    free(targets);
+    return relabeled;
+}
+
+/* mean |i - j| over the edges, a rough measure of locality. */
+double edge_span(const struct Adjacency *graph)
+{
+    long E = 0, span = 0;
+    struct Cursor it;
+    int w;
+    for (int v = 0; v < graph->V; v++)
+        for (cursor_begin(graph, v, &it); cursor_next(graph, &it, &w);)
+        {
+            E++;
+            span += labs((long)w - v);
+        }
+    return E ? (double)span / E : 0;
+}
+
+#endif
@@ -0,0 +1,232 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "utils.h"
+#include "graph.h"
+#include "ring.h"
+#include <signal.h>
+#include <string.h>
+
+/**
+ * parallel.h
+ * level synchronous BFS shared with a team of helper threads. the caller
+ * expands small levels alone; once a frontier has PARALLEL_FRONTIER
+ * vertices it is published to the helpers, everyone claims chunks of it,
+ * claims discovered vertices by CAS on the parent array and appends them to
+ * the next frontier in batches. one search uses the team at a time, the
+ * others fall back to BFS().
+ * @see server.c
+ **/
+
+#define PARALLEL_FRONTIER 1024 // smallest frontier worth waking the helpers for.
+#define PARALLEL_CHUNK 64      // frontier vertices claimed at once.
+#define PARALLEL_BATCH 256     // discovered vertices buffered before appending.
+
+/* one level being expanded */
+struct ParallelLevel
+{
+    struct Graph *graph;
+    int *frontier, size;
+    atomic_int next_chunk;
+    atomic_int *parent;
+    int *next;
+    atomic_int next_tail;
+    int end;
+    atomic_int found;
+    atomic_long vertices, edges;
+};
+
+struct BfsTeam
+{
+    int n; // helper threads, the caller works too.
+    pthread_t *threads;
+    sem_t *busy;
+    struct ParallelLevel level;
+    atomic_uint generation; // bumped for every published level.
+    atomic_int remaining;   // helpers still on the current level.
+    atomic_int stop;
+    struct Event start, done;
+};
+
+void parallel_flush(struct ParallelLevel *level, int *batch, int *n)
+{
+    int at = atomic_fetch_add(&level->next_tail, *n);
+    memcpy(level->next + at, batch, sizeof(int) * *n);
+    *n = 0;
+}
+
+/* claims chunks of the frontier until it is exhausted or end was found. */
+void parallel_expand(struct ParallelLevel *level)
+{
+    int batch[PARALLEL_BATCH], n = 0;
+    long vertices = 0, edges = 0;
+    int begin;
+    while (!atomic_load_explicit(&level->found, memory_order_relaxed) &&
+           (begin = atomic_fetch_add(&level->next_chunk, PARALLEL_CHUNK)) < level->size)
+    {
+        int stop = begin + PARALLEL_CHUNK < level->size ? begin + PARALLEL_CHUNK : level->size;
+        for (int i = begin; i < stop; i++)
+        {
+            int node = level->frontier[i];
+            vertices++;
+            for (struct AdjacencyNode *adj = level->graph->list[node]; adj != NULL; adj = adj->next)
+            {
+                edges++;
+                atomic_int *slot = &level->parent[adj->vertex];
+                int expected = -1;
+                if (atomic_load_explicit(slot, memory_order_relaxed) != -1 ||
+                    !atomic_compare_exchange_strong_explicit(slot, &expected, node,
+                                                             memory_order_relaxed, memory_order_relaxed))
+                    continue;
+                batch[n++] = adj->vertex;
+                if (n == PARALLEL_BATCH)
+                    parallel_flush(level, batch, &n);
+                if (adj->vertex == level->end)
+                    atomic_store(&level->found, TRUE);
+            }
+        }
+    }
+    if (n > 0)
+        parallel_flush(level, batch, &n);
+    atomic_fetch_add_explicit(&level->vertices, vertices, memory_order_relaxed);
+    atomic_fetch_add_explicit(&level->edges, edges, memory_order_relaxed);
+}
+
+void *bfs_helper(void *p)
+{
+    struct BfsTeam *team = (struct BfsTeam *)p;
+    sigset_t set; // signals belong to the handler threads.
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    unsigned int seen = 0;
+    while (TRUE)
+    {
+        unsigned int seq = event_prepare(&team->start);
+        if (atomic_load(&team->stop))
+        {
+            event_cancel(&team->start);
+            break;
+        }
+        if (atomic_load(&team->generation) == seen)
+        {
+            event_wait(&team->start, seq);
+            continue;
+        }
+        event_cancel(&team->start);
+        seen = atomic_load(&team->generation);
+        parallel_expand(&team->level);
+        if (atomic_fetch_sub(&team->remaining, 1) == 1)
+            event_notify(&team->done, 1);
+    }
+    return NULL;
+}
+
+struct BfsTeam *create_bfs_team(int n)
+{
+    struct BfsTeam *team = (struct BfsTeam *)xmalloc(sizeof(struct BfsTeam));
+    team->n = n;
+    team->threads = (pthread_t *)xmalloc(sizeof(pthread_t) * n);
+    team->busy = (sem_t *)xmalloc(sizeof(sem_t));
+    xsem_init(team->busy, 1);
+    atomic_init(&team->generation, 0);
+    atomic_init(&team->remaining, 0);
+    atomic_init(&team->stop, FALSE);
+    event_init(&team->start);
+    event_init(&team->done);
+    for (int i = 0; i < n; i++)
+        xthread_create(&team->threads[i], bfs_helper, team);
+    return team;
+}
+
+/* expands team->level with the helpers and waits for all of them. */
+void parallel_level(struct BfsTeam *team)
+{
+    atomic_store(&team->remaining, team->n);
+    atomic_fetch_add(&team->generation, 1);
+    event_notify(&team->start, team->n);
+    parallel_expand(&team->level);
+    while (TRUE)
+    {
+        unsigned int seq = event_prepare(&team->done);
+        if (atomic_load(&team->remaining) == 0)
+        {
+            event_cancel(&team->done);
+            break;
+        }
+        event_wait(&team->done, seq);
+    }
+}
+
+/* bfs_parent() with wide levels expanded by the team, bfs_bitmap() if it is
+ * busy. the deadline of stats is looked at between levels. */
+struct Queue *bfs_parallel(struct BfsTeam *team, struct Graph *graph, int start, int end,
+                           struct SearchStats *stats)
+{
+    if (!xsem_trywait(team->busy))
+        return bfs_bitmap(graph, start, end, stats);
+
+    struct ParallelLevel *level = &team->level;
+    int V = graph->V;
+    level->graph = graph;
+    level->end = end;
+    level->parent = (atomic_int *)xmalloc(sizeof(atomic_int) * V);
+    for (int i = 0; i < V; i++)
+        atomic_init(&level->parent[i], -1);
+    level->frontier = (int *)xmalloc(sizeof(int) * V);
+    level->next = (int *)xmalloc(sizeof(int) * V);
+    atomic_init(&level->found, start == end);
+    atomic_init(&level->vertices, 0);
+    atomic_init(&level->edges, 0);
+
+    atomic_store(&level->parent[start], start);
+    level->frontier[0] = start;
+    level->size = 1;
+    while (level->size > 0 && !atomic_load(&level->found) && !search_expired(stats))
+    {
+        atomic_store(&level->next_chunk, 0);
+        atomic_store(&level->next_tail, 0);
+        if (level->size >= PARALLEL_FRONTIER && team->n > 0)
+            parallel_level(team);
+        else
+            parallel_expand(level);
+
+        int *t = level->frontier;
+        level->frontier = level->next;
+        level->next = t;
+        level->size = atomic_load(&level->next_tail);
+    }
+
+    struct Queue *result = NULL;
+    if (atomic_load(&level->parent[end]) != -1)
+    {
+        // the helpers are done with the array, read it as plain ints.
+        int *parent = level->frontier;
+        for (int i = 0; i < V; i++)
+            parent[i] = atomic_load_explicit(&level->parent[i], memory_order_relaxed);
+        result = trace_path(parent, start, end, V);
+    }
+    if (stats != NULL)
+    {
+        stats->vertices += atomic_load(&level->vertices);
+        stats->edges += atomic_load(&level->edges);
+    }
+    free(level->parent);
+    free(level->frontier);
+    free(level->next);
+    xsem_post(team->busy);
+    return result;
+}
+
+void destroy_bfs_team(struct BfsTeam *team)
+{
+    atomic_store(&team->stop, TRUE);
+    event_notify(&team->start, team->n);
+    for (int i = 0; i < team->n; i++)
+        xthread_join(team->threads[i]);
+    xsem_destroy(team->busy);
+    free(team->busy);
+    free(team->threads);
+}
+
+#endif
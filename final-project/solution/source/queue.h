@@ -82,6 +82,8 @@ int size(struct Queue *q)
 
 void copy(struct Queue *src, struct Queue *dest)
 {
+    if (dest->cap < src->cap) // src may have been enlarged.
+        dest->line = (long *)xrealloc(dest->line, src->cap * sizeof(long));
     dest->back = src->back;
     dest->cap = src->cap;
     dest->front = src->front;
@@ -97,6 +99,7 @@ void enlarge(struct Queue **queue)
     while (!is_empty(*queue))
         enqueue(&new_queue, dequeue(*queue));
     destroy_queue(*queue);
+    free(*queue);
     *queue = new_queue;
 }
 
@@ -0,0 +1,257 @@
+#ifndef RING_H
+#define RING_H
+
+#include "utils.h"
+#include <stdatomic.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+/**
+ * ring.h
+ * bounded lock-free multi-producer/multi-consumer queue. every slot carries
+ * a sequence number telling whether it is ready to be written or read, so
+ * producers and consumers only race on their own cursor with a CAS.
+ * threads that find the ring empty (or full) park on a futex instead of spinning.
+ * @see server.c
+ **/
+
+#define CACHE_LINE 64
+
+/* futex based event count, lets threads sleep until a condition may have changed */
+struct Event
+{
+    atomic_uint seq;
+    atomic_int sleepers;
+};
+
+struct RingSlot
+{
+    atomic_ulong seq;
+    long item;
+};
+
+struct Ring
+{
+    unsigned long mask;
+    struct RingSlot *slots;
+    atomic_int closed;
+
+    /* cursors are written by different threads, keep them on separate lines */
+    char pad0[CACHE_LINE];
+    atomic_ulong head; // next slot to push.
+    char pad1[CACHE_LINE];
+    atomic_ulong tail; // next slot to pop.
+    char pad2[CACHE_LINE];
+
+    struct Event not_empty, not_full;
+};
+
+/* timeout is relative, NULL sleeps until woken. */
+void xfutex_wait(atomic_uint *addr, unsigned int val, const struct timespec *timeout)
+{
+    if (syscall(SYS_futex, (unsigned int *)addr, FUTEX_WAIT_PRIVATE, val, timeout, NULL, 0) == -1 &&
+        errno != EAGAIN && errno != EINTR && errno != ETIMEDOUT)
+        xerror(__func__, "futex wait");
+}
+
+void xfutex_wake(atomic_uint *addr, int n)
+{
+    if (syscall(SYS_futex, (unsigned int *)addr, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0) == -1)
+        xerror(__func__, "futex wake");
+}
+
+void event_init(struct Event *e)
+{
+    atomic_init(&e->seq, 0);
+    atomic_init(&e->sleepers, 0);
+}
+
+/* announce a sleeper, the condition must be checked again before event_wait(). */
+unsigned int event_prepare(struct Event *e)
+{
+    atomic_fetch_add(&e->sleepers, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    return atomic_load(&e->seq);
+}
+
+/* condition became true after event_prepare(), no need to sleep. */
+void event_cancel(struct Event *e)
+{
+    atomic_fetch_sub(&e->sleepers, 1);
+}
+
+void event_wait(struct Event *e, unsigned int seq)
+{
+    xfutex_wait(&e->seq, seq, NULL);
+    atomic_fetch_sub(&e->sleepers, 1);
+}
+
+/* like event_wait(), but gives up after ms milliseconds. */
+void event_timedwait(struct Event *e, unsigned int seq, long ms)
+{
+    struct timespec timeout = {ms / 1000, (ms % 1000) * 1000000};
+    xfutex_wait(&e->seq, seq, &timeout);
+    atomic_fetch_sub(&e->sleepers, 1);
+}
+
+/* wake up to n sleepers, costs no syscall when nobody sleeps. */
+void event_notify(struct Event *e, int n)
+{
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load(&e->sleepers) > 0) // a later sleeper will see the new state itself.
+    {
+        atomic_fetch_add(&e->seq, 1);
+        xfutex_wake(&e->seq, n);
+    }
+}
+
+struct Ring *create_ring(unsigned int _cap)
+{
+    unsigned long cap = 1;
+    while (cap < _cap) // round up to a power of two, index is masked.
+        cap <<= 1;
+
+    struct Ring *r = (struct Ring *)xmalloc(sizeof(struct Ring));
+    r->mask = cap - 1;
+    r->slots = (struct RingSlot *)xmalloc(cap * sizeof(struct RingSlot));
+    for (unsigned long i = 0; i < cap; i++)
+    {
+        atomic_init(&r->slots[i].seq, i);
+        r->slots[i].item = 0;
+    }
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    atomic_init(&r->closed, FALSE);
+    event_init(&r->not_empty);
+    event_init(&r->not_full);
+    return r;
+}
+
+/* returns FALSE if the ring is full. */
+int ring_try_push(struct Ring *r, long item)
+{
+    struct RingSlot *slot;
+    unsigned long pos = atomic_load_explicit(&r->head, memory_order_relaxed);
+    while (TRUE)
+    {
+        slot = &r->slots[pos & r->mask];
+        unsigned long seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        long dif = (long)seq - (long)pos;
+        if (dif == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&r->head, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+        else if (dif < 0)
+            return FALSE;
+        else
+            pos = atomic_load_explicit(&r->head, memory_order_relaxed);
+    }
+
+    slot->item = item;
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+    event_notify(&r->not_empty, 1);
+    return TRUE;
+}
+
+/* returns FALSE if the ring is empty. */
+int ring_try_pop(struct Ring *r, long *item)
+{
+    struct RingSlot *slot;
+    unsigned long pos = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    while (TRUE)
+    {
+        slot = &r->slots[pos & r->mask];
+        unsigned long seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        long dif = (long)seq - (long)(pos + 1);
+        if (dif == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&r->tail, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+        else if (dif < 0)
+            return FALSE;
+        else
+            pos = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    }
+
+    *item = slot->item;
+    atomic_store_explicit(&slot->seq, pos + r->mask + 1, memory_order_release);
+    event_notify(&r->not_full, 1);
+    return TRUE;
+}
+
+/* pushes the item, sleeps while the ring is full. returns FALSE if the ring is closed. */
+int ring_push(struct Ring *r, long item)
+{
+    while (!atomic_load(&r->closed))
+    {
+        if (ring_try_push(r, item))
+            return TRUE;
+
+        unsigned int seq = event_prepare(&r->not_full);
+        if (ring_try_push(r, item))
+        {
+            event_cancel(&r->not_full);
+            return TRUE;
+        }
+        if (atomic_load(&r->closed))
+        {
+            event_cancel(&r->not_full);
+            break;
+        }
+        event_wait(&r->not_full, seq);
+    }
+    return FALSE;
+}
+
+/* pops an item, sleeps while the ring is empty. returns FALSE once closed and drained. */
+int ring_pop(struct Ring *r, long *item)
+{
+    while (TRUE)
+    {
+        if (ring_try_pop(r, item))
+            return TRUE;
+
+        unsigned int seq = event_prepare(&r->not_empty);
+        if (ring_try_pop(r, item))
+        {
+            event_cancel(&r->not_empty);
+            return TRUE;
+        }
+        if (atomic_load(&r->closed))
+        {
+            event_cancel(&r->not_empty);
+            return FALSE;
+        }
+        event_wait(&r->not_empty, seq);
+    }
+}
+
+/* refuse new items and wake everybody, consumers still drain what is left. */
+void ring_close(struct Ring *r)
+{
+    atomic_store(&r->closed, TRUE);
+    event_notify(&r->not_empty, INT_MAX);
+    event_notify(&r->not_full, INT_MAX);
+}
+
+/* approximate number of items, exact when no push/pop is in progress. */
+int ring_size(struct Ring *r)
+{
+    unsigned long head = atomic_load(&r->head);
+    unsigned long tail = atomic_load(&r->tail);
+    return head > tail ? (int)(head - tail) : 0;
+}
+
+void destroy_ring(struct Ring *r)
+{
+    free(r->slots);
+}
+
+#endif
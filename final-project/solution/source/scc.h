@@ -0,0 +1,219 @@
+#ifndef SCC_H
+#define SCC_H
+
+#include "utils.h"
+#include "graph.h"
+#include "compressed.h"
+#include <limits.h>
+
+/**
+ * scc.h
+ * strongly connected components of the graph and a reachability summary
+ * of their condensation DAG, built once after loading. it answers "t is
+ * certainly not reachable from s" in O(1) for most such pairs:
+ *  - Tarjan numbers components in reverse topological order, so s can only
+ *    reach t if comp[s] >= comp[t].
+ *  - every component gets a DFS interval [low, post] over the DAG, and the
+ *    interval of anything reachable is nested in the interval of its source.
+ * it never claims unreachable for a reachable pair, the remaining pairs
+ * still go to BFS.
+ * @see server.c
+ **/
+
+struct SCCIndex
+{
+    int count;     // number of components.
+    int largest;   // vertices in the largest component.
+    int *comp;     // component of every vertex.
+    int *low;      // smallest post order number reachable from the component.
+    int *post;     // post order number of the component in the DAG DFS.
+};
+
+/* iterative Tarjan, fills index->comp and index->count. */
+void find_components(const struct Adjacency *graph, struct SCCIndex *index)
+{
+    int V = graph->V;
+    int *order = (int *)xmalloc(sizeof(int) * V); // discovery number, -1 unvisited.
+    int *low = (int *)xmalloc(sizeof(int) * V);
+    int *stack = (int *)xmalloc(sizeof(int) * V);
+    char *on_stack = (char *)xmalloc(V);
+    int *call = (int *)xmalloc(sizeof(int) * V); // explicit DFS call stack.
+    struct Cursor *next = (struct Cursor *)xmalloc(sizeof(struct Cursor) * V);
+    for (int i = 0; i < V; i++)
+    {
+        order[i] = -1;
+        on_stack[i] = FALSE;
+    }
+
+    int counter = 0, sp = 0;
+    index->count = index->largest = 0;
+    for (int root = 0; root < V; root++)
+    {
+        if (order[root] != -1)
+            continue;
+        order[root] = low[root] = counter++;
+        stack[sp++] = root;
+        on_stack[root] = TRUE;
+        call[0] = root;
+        cursor_begin(graph, root, &next[0]);
+        int depth = 1;
+
+        while (depth > 0)
+        {
+            int v = call[depth - 1], w;
+            if (cursor_next(graph, &next[depth - 1], &w))
+            {
+                if (order[w] == -1) // descend.
+                {
+                    order[w] = low[w] = counter++;
+                    stack[sp++] = w;
+                    on_stack[w] = TRUE;
+                    call[depth] = w;
+                    cursor_begin(graph, w, &next[depth]);
+                    depth++;
+                }
+                else if (on_stack[w] && order[w] < low[v])
+                    low[v] = order[w];
+                continue;
+            }
+
+            if (low[v] == order[v]) // v is the root of a component.
+            {
+                int members = 0;
+                do
+                {
+                    w = stack[--sp];
+                    on_stack[w] = FALSE;
+                    index->comp[w] = index->count;
+                    members++;
+                } while (w != v);
+                index->count++;
+                if (members > index->largest)
+                    index->largest = members;
+            }
+            depth--;
+            if (depth > 0 && low[v] < low[call[depth - 1]])
+                low[call[depth - 1]] = low[v];
+        }
+    }
+
+    free(order);
+    free(low);
+    free(stack);
+    free(on_stack);
+    free(call);
+    free(next);
+}
+
+/* DFS over the condensation DAG, fills index->low and index->post. */
+void label_intervals(const struct Adjacency *graph, struct SCCIndex *index)
+{
+    int C = index->count;
+
+    // condensation edges in compressed rows, duplicates are harmless.
+    int *offset = (int *)xmalloc(sizeof(int) * (C + 1));
+    for (int c = 0; c <= C; c++)
+        offset[c] = 0;
+    struct Cursor it;
+    int w;
+    for (int v = 0; v < graph->V; v++)
+        for (cursor_begin(graph, v, &it); cursor_next(graph, &it, &w);)
+            if (index->comp[v] != index->comp[w])
+                offset[index->comp[v] + 1]++;
+    for (int c = 0; c < C; c++)
+        offset[c + 1] += offset[c];
+    int *fill = (int *)xmalloc(sizeof(int) * (C + 1));
+    for (int c = 0; c <= C; c++)
+        fill[c] = offset[c];
+    int *dag = (int *)xmalloc(sizeof(int) * (offset[C] + 1));
+    for (int v = 0; v < graph->V; v++)
+        for (cursor_begin(graph, v, &it); cursor_next(graph, &it, &w);)
+            if (index->comp[v] != index->comp[w])
+                dag[fill[index->comp[v]]++] = index->comp[w];
+
+    int *call = (int *)xmalloc(sizeof(int) * C);
+    for (int c = 0; c < C; c++)
+        index->post[c] = -1;
+
+    // higher numbers come first topologically, start from them.
+    int counter = 0;
+    for (int root = C - 1; root >= 0; root--)
+    {
+        if (index->post[root] != -1)
+            continue;
+        int depth = 0;
+        call[depth++] = root;
+        index->post[root] = -2; // in progress.
+        index->low[root] = INT_MAX;
+        fill[root] = offset[root];
+
+        while (depth > 0)
+        {
+            int c = call[depth - 1];
+            if (fill[c] < offset[c + 1])
+            {
+                int d = dag[fill[c]++];
+                if (index->post[d] == -1)
+                {
+                    index->post[d] = -2;
+                    index->low[d] = INT_MAX;
+                    fill[d] = offset[d];
+                    call[depth++] = d;
+                }
+                else if (index->low[d] < index->low[c]) // finished, a DAG has no back edges.
+                    index->low[c] = index->low[d];
+                continue;
+            }
+
+            index->post[c] = counter++;
+            if (index->post[c] < index->low[c])
+                index->low[c] = index->post[c];
+            depth--;
+            if (depth > 0 && index->low[c] < index->low[call[depth - 1]])
+                index->low[call[depth - 1]] = index->low[c];
+        }
+    }
+
+    free(offset);
+    free(fill);
+    free(dag);
+    free(call);
+}
+
+struct SCCIndex *build_scc_index(const struct Adjacency *graph)
+{
+    struct SCCIndex *index = (struct SCCIndex *)xmalloc(sizeof(struct SCCIndex));
+    index->comp = (int *)xmalloc(sizeof(int) * graph->V);
+    find_components(graph, index);
+
+    index->low = (int *)xmalloc(sizeof(int) * index->count);
+    index->post = (int *)xmalloc(sizeof(int) * index->count);
+    label_intervals(graph, index);
+    return index;
+}
+
+/* TRUE if end is certainly not reachable from start, FALSE if it may be. */
+int scc_unreachable(struct SCCIndex *index, int start, int end)
+{
+    int cs = index->comp[start], ce = index->comp[end];
+    if (cs == ce)
+        return FALSE;
+    if (cs < ce) // end's component is earlier in topological order.
+        return TRUE;
+    return index->low[ce] < index->low[cs] || index->post[ce] > index->post[cs];
+}
+
+/* TRUE if start and end are in the same component, so reachable both ways. */
+int scc_same(struct SCCIndex *index, int start, int end)
+{
+    return index->comp[start] == index->comp[end];
+}
+
+void destroy_scc_index(struct SCCIndex *index)
+{
+    free(index->comp);
+    free(index->low);
+    free(index->post);
+}
+
+#endif
@@ -0,0 +1,158 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "utils.h"
+#include "ring.h"
+
+/**
+ * scheduler.h
+ * work stealing dispatch for the pool of connection handlers. every worker
+ * owns a local queue, the server thread spreads connections over them round
+ * robin and a worker that runs out of local work steals from the others
+ * before it parks. there is no shared queue, so under load workers only
+ * touch their own cache lines.
+ * @see server.c
+ **/
+
+#define LOCAL_QUEUE_CAP 256
+
+struct Scheduler
+{
+    int n;               // number of local queues, one per possible worker.
+    struct Ring **local; // each ring lives in its own allocation.
+    atomic_int active;   // workers currently in the pool, connections go to them.
+    atomic_int closed;
+
+    char pad0[CACHE_LINE];
+    atomic_uint next; // round robin cursor, written by the server thread only.
+    char pad1[CACHE_LINE];
+
+    struct Event work; // idle workers park here.
+};
+
+struct Scheduler *create_scheduler(int n, int active)
+{
+    struct Scheduler *s = (struct Scheduler *)xmalloc(sizeof(struct Scheduler));
+    s->n = n > 0 ? n : 1;
+    n = s->n;
+    s->local = (struct Ring **)xmalloc(n * sizeof(struct Ring *));
+    for (int i = 0; i < n; i++)
+        s->local[i] = create_ring(LOCAL_QUEUE_CAP);
+    atomic_init(&s->active, active < 1 ? 1 : (active > n ? n : active));
+    atomic_init(&s->closed, FALSE);
+    atomic_init(&s->next, 0);
+    event_init(&s->work);
+    return s;
+}
+
+/* worker count changed, new connections are spread over [0, active).
+ * workers at or above active retire, parked ones are woken to notice it. */
+void sched_set_active(struct Scheduler *s, int active)
+{
+    active = active < 1 ? 1 : (active > s->n ? s->n : active);
+    int old = atomic_exchange(&s->active, active);
+    if (active < old)
+        event_notify(&s->work, INT_MAX);
+}
+
+/* queue an item to the next worker with room, FALSE if every local queue
+ * is full or the scheduler is closed. *target gets the worker it was meant for. */
+int sched_try_submit(struct Scheduler *s, long item, int *target)
+{
+    *target = 0;
+    if (atomic_load(&s->closed))
+        return FALSE;
+    int active = atomic_load_explicit(&s->active, memory_order_relaxed);
+    unsigned int next = atomic_load_explicit(&s->next, memory_order_relaxed);
+    atomic_store_explicit(&s->next, next + 1, memory_order_relaxed);
+
+    *target = next % active;
+    for (int k = 0; k < active; k++)
+        if (ring_try_push(s->local[(*target + k) % active], item))
+        {
+            event_notify(&s->work, 1);
+            return TRUE;
+        }
+    return FALSE;
+}
+
+/* queue an item to the next worker, returns FALSE if the scheduler is closed.
+ * skips over full queues, only blocks when every local queue is full. */
+int sched_submit(struct Scheduler *s, long item)
+{
+    int target;
+    if (sched_try_submit(s, item, &target))
+        return TRUE;
+    if (!ring_push(s->local[target], item))
+        return FALSE;
+    event_notify(&s->work, 1);
+    return TRUE;
+}
+
+/* own queue first, then steal starting from the neighbour. */
+int sched_try_take(struct Scheduler *s, int self, long *item)
+{
+    if (ring_try_pop(s->local[self], item))
+        return TRUE;
+    for (int k = 1; k < s->n; k++)
+        if (ring_try_pop(s->local[(self + k) % s->n], item))
+            return TRUE;
+    return FALSE;
+}
+
+/* takes an item for worker self, parks while there is no work anywhere.
+ * returns FALSE once the scheduler is closed and drained, or once the worker
+ * is retired and its own queue is empty (leftovers get stolen by the rest). */
+int sched_take(struct Scheduler *s, int self, long *item)
+{
+    while (TRUE)
+    {
+        if (self >= atomic_load(&s->active))
+            return ring_try_pop(s->local[self], item);
+        if (sched_try_take(s, self, item))
+            return TRUE;
+
+        unsigned int seq = event_prepare(&s->work);
+        if (sched_try_take(s, self, item))
+        {
+            event_cancel(&s->work);
+            return TRUE;
+        }
+        if (atomic_load(&s->closed))
+        {
+            event_cancel(&s->work);
+            return FALSE;
+        }
+        event_wait(&s->work, seq);
+    }
+}
+
+/* number of queued items over all workers. */
+int sched_size(struct Scheduler *s)
+{
+    int total = 0;
+    for (int i = 0; i < s->n; i++)
+        total += ring_size(s->local[i]);
+    return total;
+}
+
+/* refuse new items and wake every worker, queued items are still handed out. */
+void sched_close(struct Scheduler *s)
+{
+    atomic_store(&s->closed, TRUE);
+    for (int i = 0; i < s->n; i++)
+        ring_close(s->local[i]);
+    event_notify(&s->work, INT_MAX);
+}
+
+void destroy_scheduler(struct Scheduler *s)
+{
+    for (int i = 0; i < s->n; i++)
+    {
+        destroy_ring(s->local[i]);
+        free(s->local[i]);
+    }
+    free(s->local);
+}
+
+#endif
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE // SCHED_IDLE, cpu affinity.
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/file.h>
@@ -10,47 +11,110 @@
 #include <arpa/inet.h>
 #include <time.h>
 #include <signal.h>
+#include <ctype.h>
+#include <sys/wait.h>
 #include "utils.h"
 #include "graph.h"
 #include "cache.h"
-
-/* literals regarding to graph input */
-#define NEWLINE_DELIMETER "\n"
-#define COMMENT_DELIMETER '#'
-#define TAB_DELIMETER '\t'
+#include "scheduler.h"
+#include "log.h"
+#include "stats.h"
+#include "scc.h"
+#include "landmark.h"
+#include "order.h"
+#include "compressed.h"
+#include "parallel.h"
+#include "shmcache.h"
+#include "dijkstra.h"
+#include "yen.h"
+#include "distcache.h"
+#include "numa.h"
 
 /* literals regarding to internal flow */
 #define SEM_SINGLE_INSTANCE_NAME "sem-single-instance"
 #define MAX_LOAD 0.75
+#define MIN_LOAD 0.25
+#define SAMPLE_PERIOD_MS 100 // resizer samples the load this often.
+#define IDLE_SAMPLES 30      // consecutive low load samples before shrinking.
+#define EWMA_ALPHA 0.3
+#define STATS_MAX_BYTE 4096
+#define UPDATE_REPLY_BYTE 128
+#define UPDATE_SCAN_EDGES 64 // bigger batches drop the whole cache instead of checking each path.
+#define SHARED_NAME_BYTE 64
+#define WORKER_RESPAWN_US 1000000 // a worker dying sooner after its start is restarted this much later.
+#define KIND_SHIFT 8 // cache kind of a QUERY_KPATHS answer: QUERY_KPATHS | k << KIND_SHIFT.
+#define KIND_MASK ((1 << KIND_SHIFT) - 1)
+#define WARM_MAX_PAIRS 65536   // recent pairs kept in the -W file.
+#define WARM_THREADS 2
+#define WARM_SEARCH_US 1000000 // a warming search taking longer is given up.
+#define WARM_BACKOFF_US 1000   // warmers sleep this long while connections wait.
+
+/* the loaded graph and everything derived from it, swapped whole on SIGHUP */
+struct Snapshot
+{
+    struct Graph *graph;         // NULL with -C, never built.
+    struct CompressedGraph *compressed;
+    struct Graph **replicas;     // with -N replicate, graph copied to every node, [0] is graph itself.
+    struct CompressedGraph **compressed_replicas; // the same with -C.
+    int V;
+    int *perm, *sequence;        // file id -> internal id and back, NULL without -O.
+    struct SCCIndex *scc;        // answers most unreachable queries without a BFS.
+    struct Graph *reverse;       // only kept with landmarks or weights, and without -C.
+    int weighted;                // the input has a weight column, weighted queries run Dijkstra.
+    struct LandmarkIndex *landmarks;
+    struct Cache *cache;         // paths found on this graph, NULL with -M.
+    struct DistanceCache *distances; // hop distances found on this graph, also with -M.
+    int generation;              // 0 for the graph read at startup, +1 per reload.
+    unsigned long signature;     // input file it was read from, tags shared cache paths.
+};
 
 /* A resource shared between server thread and the pool */
 struct ConnHandlerResource
 {
-    struct Graph *graph;
-    struct Queue *client_queue;
-
-    /* sync for server main thread and connection handler threads*/
-    sem_t *graph_mutex;
-    sem_t *handler_sem;
-    int finished;
+    struct Snapshot *snapshot;
+    pthread_t reloader;          // waits for SIGHUP.
+    struct SharedCache *shared;  // with -M, replaces the snapshots' caches.
+    struct BfsTeam *team;        // helpers of wide searches, NULL without -P.
+    struct Scheduler *scheduler; // per worker queues, server thread to the pool.
+    long *accepted_at;           // accept time of each open client fd, for queue wait.
+    int max_fd;
+    struct Stats *stats;
+    struct NumaTopology *numa;
+
+    /* pairs of the -W file, oldest first, computed into the cache by the warmers */
+    struct Packet *warm;
+    int warm_count;
+    atomic_int warm_next, warm_stop;
+    pthread_t warmers[WARM_THREADS];
+    int warming;
+    int record_fd;               // the -W file opened to append to with -R, -1 otherwise.
+    atomic_long seen, recorded;  // path queries, and those appended.
+
+    /* searches read the snapshot, edge updates write it and reloads swap it */
+    struct RWLock graph_lock;
 
     /* sync for cache read/write in connection handler threads */
     sem_t *read_try;
     sem_t *read_mutex, *write_mutex;
     int read_count, write_count;
     sem_t *cache_mutex;
-    struct Cache *cache;
+    atomic_int cache_full; // an insert was refused by the -K limit, @see trim_cache.
 };
 
 struct DynamicPoolerResource
 {
-    pthread_t *pool;
+    pthread_t *pool; // sized for max_thread, never reallocated.
     int n; // number of threads.
     sem_t *pooler_sem;
     sem_t *load_mutex;
     pthread_t main_thread;
     int resize;
     int handler_count;
+
+    /* service time of the requests finished since the last sample */
+    long served, service_us;
+    /* smoothed view of the load, only touched by the resizer */
+    double load_ewma, service_ewma, arrival_ewma; // arrivals per second.
 };
 
 sem_t *single_instance_sem;
@@ -59,28 +123,49 @@ sem_t *single_instance_sem;
 struct Args args;
 struct ConnHandlerResource *conr = NULL;
 struct DynamicPoolerResource *dynr = NULL;
+int worker = 0; // 1..-w in a worker process, 0 in the master or without -w.
 
 void become_daemon(); // become a daemon by following some routines.
-void read_graph();    // load the graph to memory from input file.
+void read_graph();    // load the graph to memory from input file, reload it on SIGHUP.
+void supervise_workers(); // fork the workers with -w and look after them.
 void create_pool();
-void attach_sigint_handler();
+void start_terminator();    // the thread that shuts the server down on SIGINT.
 void init_shared_resources();
 void destroy_shared_resources();
 
 void connection_listener();       // function of server thread.
+void refuse_connection(int clientfd);
+void send_reply(int nth, int clientfd, const void *buf, int len);
 void *connection_handler(void *); // function of pool of threads.
 void *pool_resizer(void *);       // function for thread handling dynamic pooling.
+void read_warm_pairs();           // -W file into conr->warm, kept open for -R.
+void trim_cache(int nth);         // clears a cache that reached its -K limit.
+void start_warming();
+void stop_warming();
 void create_sem();
 
 int main(int argc, char *argv[])
 {
     create_sem(); /* prevent double instanstation */
     parse_args(argc, argv, &args);
+    log_init(args.outfd, args.log_level);
+    xlog(LOG_INFO, "Executing with parameters: \n-i %s\n-p %d\n-o %s\n-s %d\n-x %d\n-l %d\n-L %d\n-O %d\n-C %d\n-P %d\n-w %d\n-M %d\n-K %d\n"
+         "-Q %d\n-T %d\n-B %d\n-W %s\n-R %d\n-N %d\n-A %d\n",
+         args.input, args.port, args.output, args.min_thread, args.max_thread, args.log_level, args.landmarks,
+         args.order, args.compressed, args.helpers, args.workers, args.shared_cache, args.cache_limit, args.queue_limit,
+         args.deadline_ms, args.backlog, args.warm ? args.warm : "none", args.record,
+         args.numa, args.pin);
     become_daemon();
+    log_start();
     init_shared_resources();
-    attach_sigint_handler();
+    if (args.workers == 0) // the master of the workers takes SIGINT in supervise_workers.
+        start_terminator();
     read_graph();
+    read_warm_pairs();
+    if (args.workers > 0)
+        supervise_workers(); // the workers create their own pools.
     create_pool();
+    start_warming();
     connection_listener();
 
     return 0;
@@ -89,15 +174,6 @@ int main(int argc, char *argv[])
 void create_sem();
 void delete_sem();
 
-int is_finished()
-{
-    xsem_wait(conr->graph_mutex);
-    int finished = conr->finished;
-    int clients = size(conr->client_queue);
-    xsem_post(conr->graph_mutex);
-    return finished && !clients;
-}
-
 void kill_thread(pthread_t tid)
 {
     if (pthread_cancel(tid) != 0)
@@ -105,42 +181,52 @@ void kill_thread(pthread_t tid)
     xthread_join(tid);
 }
 
-void handle_sigint()
+/* waits for SIGINT, blocked in every thread since become_daemon, and shuts
+ * down from its own thread: no other thread is interrupted, so whatever
+ * it was doing (an xlog included) is finished or cancelled cleanly. */
+void *terminator(void *p)
 {
-    delete_sem();
-    dprintf(args.outfd, "[%s] Termination signal received, waiting for ongoing threads to complete.\n", timestamp());
+    (void)p;
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    int sig;
+    if (sigwait(&set, &sig) != 0)
+        xerror(__func__, "sigwait");
+
+    if (worker == 0) // the master of the workers owns it.
+        delete_sem();
+    xlog(LOG_INFO, "Termination signal received, waiting for ongoing threads to complete.\n");
 
     if (dynr->pool != NULL)
     {
-        xsem_wait(conr->graph_mutex);
-        conr->finished = TRUE;
-        xsem_post(conr->graph_mutex);
-
-        pthread_t tid = pthread_self();
-
-        if (tid != dynr->main_thread)
-            kill_thread(dynr->main_thread);
+        // closed first, an acceptor blocked pushing into full rings is no cancellation point.
+        sched_close(conr->scheduler);
+        kill_thread(dynr->main_thread);
 
         // wait for resizer thread.
-        if (tid != dynr->pool[0])
-            kill_thread(dynr->pool[0]);
+        kill_thread(dynr->pool[0]);
 
-        // wait for pool of handler threads to complete.
-        xsem_post(conr->handler_sem);
-        for (pthread_t i = 1; i < (unsigned)dynr->n; i++)
-        {
-            if (tid != i)
-                xthread_join(dynr->pool[i]);
-        }
+        // a reload in progress is finished first.
+        if (worker == 0)
+            kill_thread(conr->reloader);
+        stop_warming();
+
+        // wait for pool of handler threads to drain their queues and complete.
+        for (int i = 1; i < dynr->n; i++)
+            xthread_join(dynr->pool[i]);
     }
-    dprintf(args.outfd, "[%s] All threads have terminated, server shutting down.\n", timestamp());
+    xlog(LOG_INFO, "All threads have terminated, server shutting down.\n");
+    log_stop();
     destroy_shared_resources();
     exit(EXIT_SUCCESS);
+    return NULL;
 }
 
-void attach_sigint_handler()
+void start_terminator()
 {
-    signal(SIGINT, handle_sigint);
+    pthread_t tid;
+    xthread_create(&tid, terminator, NULL);
 }
 
 void become_daemon()
@@ -163,6 +249,7 @@ void become_daemon()
 
     signal(SIGCHLD, SIG_IGN);
     signal(SIGHUP, SIG_IGN);
+    signal(SIGPIPE, SIG_IGN); // replies to clients that hung up fail with EPIPE instead.
 
     switch (fork())
     {
@@ -182,80 +269,467 @@ void become_daemon()
     for (x = sysconf(_SC_OPEN_MAX); x >= 0; x--)
         if (x != args.infd && x != args.outfd)
             close(x);
+
+    // SIGHUP reloads the graph and SIGINT stops the server, only the reloader
+    // and the terminator (or the master of the workers) take them with sigwait.
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGHUP);
+    sigaddset(&set, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+    signal(SIGHUP, SIG_DFL);
 }
 
-int read_raw(int fd, char **raw)
+int max(int n1, int n2)
 {
-    int file_size = xlseek(fd, 0, SEEK_END); // learn the size of the file.
-    *raw = (char *)xmalloc(file_size);
+    return n1 > n2 ? n1 : n2;
+}
 
-    xlseek(fd, 0, SEEK_SET); // rewind.
-    if (xread(fd, *raw, file_size) != file_size)
-        xerror(__func__, "file_size does not match!");
-    xclose(fd);
-    return file_size;
+/* the adjacency s serves from, the varint one under -C. */
+struct Adjacency snapshot_adjacency(struct Snapshot *s)
+{
+    return s->compressed != NULL ? varint_adjacency(s->compressed) : linked_adjacency(s->graph);
 }
 
-int is_comment(char *line)
+/* (re)builds the component index of the adjacency. */
+void build_scc(struct Snapshot *s)
 {
-    return line[0] == COMMENT_DELIMETER;
+    struct Adjacency graph = snapshot_adjacency(s);
+    clock_t start = clock();
+    if (s->scc != NULL)
+    {
+        destroy_scc_index(s->scc);
+        free(s->scc);
+    }
+    s->scc = build_scc_index(&graph);
+    xlog(LOG_INFO, "Component index built in %.6f seconds with %d components, largest has %d nodes.\n",
+            (double)(clock() - start) / CLOCKS_PER_SEC, s->scc->count, s->scc->largest);
 }
 
-int max(int n1, int n2)
+/* (re)builds the landmark index of the adjacency and s->reverse, or of a
+ * reverse built for it and dropped under -C. */
+void build_landmarks(struct Snapshot *s)
 {
-    return n1 > n2 ? n1 : n2;
+    clock_t start = clock();
+    struct Adjacency graph = snapshot_adjacency(s);
+    struct Adjacency reverse = s->reverse != NULL ? linked_adjacency(s->reverse) : reverse_adjacency(&graph);
+    if (s->landmarks != NULL)
+    {
+        destroy_landmark_index(s->landmarks);
+        free(s->landmarks);
+    }
+    s->landmarks = build_landmark_index(&graph, &reverse, args.landmarks);
+    if (s->reverse == NULL)
+        destroy_adjacency(&reverse);
+    xlog(LOG_INFO, "Landmark index built in %.6f seconds with %d landmarks, %ld bytes.\n",
+            (double)(clock() - start) / CLOCKS_PER_SEC, s->landmarks->k, landmark_bytes(s->landmarks));
 }
 
-// finds the number of vertices of the graph.
-int find_V(char *raw, int byte)
+/* -N replicate: copies of the adjacency, each bound to one of the other
+ * nodes. the reverse graph and the indexes stay on the first one. */
+void replicate_snapshot(struct Snapshot *s)
 {
-    char *p = raw;
-    int V = 0;
-    while (p - raw != byte)
+    int nodes = conr->numa->nodes;
+    long start = monotonic_us(), bytes = 0;
+    if (s->compressed != NULL)
+    {
+        s->compressed_replicas = (struct CompressedGraph **)xmalloc(sizeof(struct CompressedGraph *) * nodes);
+        s->compressed_replicas[0] = s->compressed;
+    }
+    else
     {
-        int i, j;
-        if (!is_comment(p))
+        s->replicas = (struct Graph **)xmalloc(sizeof(struct Graph *) * nodes);
+        s->replicas[0] = s->graph;
+    }
+    for (int n = 1; n < nodes; n++)
+    {
+        numa_set_policy(conr->numa, MPOL_BIND, n);
+        if (s->compressed != NULL)
         {
-            if ((i = str_to_int(p)) > V)
-                V = i;
-            if ((j = str_to_int(strchr(p, TAB_DELIMETER))) > V)
-                V = j;
+            s->compressed_replicas[n] = copy_compressed_graph(s->compressed);
+            bytes += compressed_bytes(s->compressed);
+        }
+        else
+        {
+            s->replicas[n] = copy_graph(s->graph);
+            bytes += sizeof(struct AdjacencyNode) * s->replicas[n]->pool_size;
         }
-
-        p = strchr(p, '\n') + 1;
     }
-    return V + 1;
+    numa_set_policy(conr->numa, MPOL_DEFAULT, 0);
+    xlog(LOG_INFO, "Adjacency replicated on %d more nodes in %ld us, %ld bytes.\n",
+         nodes - 1, monotonic_us() - start, bytes);
 }
 
-void read_graph()
+/* the memory policy of the loading thread for -N, FALSE if there is nothing
+ * to place or the kernel does not take it. */
+int place_snapshot()
+{
+    if (args.numa == NUMA_NONE || conr->numa->nodes == 1)
+        return FALSE;
+    if (numa_set_policy(conr->numa, args.numa == NUMA_INTERLEAVE ? MPOL_INTERLEAVE : MPOL_BIND, 0))
+        return TRUE;
+    xlog(LOG_ERROR, "The kernel refuses NUMA policies (errno %d), the graph is placed by first touch.\n", errno);
+    return FALSE;
+}
+
+/* reads the graph from fd (and closes it), straight into varint lists with
+ * -C, then orders and indexes it as the arguments ask, with an empty cache. with -N it is
+ * interleaved over the nodes, or built on the first one and replicated.
+ * NULL if the file cannot be read or has a malformed line. */
+struct Snapshot *load_snapshot(int fd)
 {
+    struct Snapshot *s = (struct Snapshot *)xmalloc(sizeof(struct Snapshot));
+    int placed = place_snapshot();
+    s->compressed = NULL;
+    s->replicas = NULL;
+    s->compressed_replicas = NULL;
+    s->perm = s->sequence = NULL;
+    s->scc = NULL;
+    s->reverse = NULL;
+    s->landmarks = NULL;
+    s->generation = 0;
+
     clock_t start, end;
     start = clock();
-    dprintf(args.outfd, "[%s] Loading graph...\n", timestamp());
-    char *raw;
-    int byte = read_raw(args.infd, &raw);
-    conr->graph = create_graph(find_V(raw, byte));
-    conr->cache = create_cache(conr->graph->V);
-
-    char *token = strtok(raw, NEWLINE_DELIMETER);
-    int edge_count = 0;
-    while (token != NULL) // walk through lines.
-    {
-        int i, j;
-        if (!is_comment(token))
+    xlog(LOG_INFO, "Loading graph...\n");
+    int edge_count;
+    s->signature = file_signature(fd);
+    s->graph = NULL;
+    if (args.compressed) // no AdjacencyNode is ever made for -C.
+        s->compressed = load_compressed_graph(fd, &edge_count);
+    else
+        s->graph = load_graph(fd, &edge_count);
+    if (s->graph == NULL && s->compressed == NULL)
+    {
+        if (edge_count > 0)
+            xlog(LOG_ERROR, "Line %d of %s is malformed, ids and weights are integers and ids below INT_MAX.\n", edge_count, args.input);
+        else
+            xlog(LOG_ERROR, "Cannot read %s whole.\n", args.input);
+        if (placed)
+            numa_set_policy(conr->numa, MPOL_DEFAULT, 0);
+        free(s);
+        return NULL;
+    }
+    s->V = s->compressed != NULL ? s->compressed->V : s->graph->V;
+    s->weighted = s->compressed != NULL ? s->compressed->weighted : s->graph->weighted;
+    s->cache = args.shared_cache > 0 ? NULL : create_cache(s->V, (long)args.cache_limit << 20);
+    s->distances = create_distance_cache();
+
+    end = clock();
+    xlog(LOG_INFO, "Graph loaded in %.6f seconds with %d nodes and %d edges.\n",
+            (double)(end - start) / CLOCKS_PER_SEC, s->V, edge_count);
+
+    if (args.order != ORDER_NONE)
+    {
+        start = clock();
+        struct Adjacency graph = snapshot_adjacency(s);
+        double span = edge_span(&graph);
+        s->sequence = vertex_order(&graph, args.order);
+        s->perm = invert_order(s->sequence, s->V);
+        if (s->compressed != NULL)
+        {
+            struct CompressedGraph *relabeled = relabel_compressed_graph(s->compressed, s->sequence, s->perm);
+            destroy_compressed_graph(s->compressed);
+            free(s->compressed);
+            s->compressed = relabeled;
+        }
+        else
         {
-            i = str_to_int(token);
-            j = str_to_int(strchr(token, TAB_DELIMETER));
-            add_edge(conr->graph, i, j);
-            edge_count++;
+            struct Graph *relabeled = relabel_graph(s->graph, s->sequence, s->perm);
+            destroy_graph(s->graph);
+            free(s->graph);
+            s->graph = relabeled;
         }
-        token = strtok(NULL, NEWLINE_DELIMETER);
+        graph = snapshot_adjacency(s);
+        end = clock();
+        xlog(LOG_INFO, "Graph reordered in %.6f seconds, mean edge span %.1f -> %.1f.\n",
+                (double)(end - start) / CLOCKS_PER_SEC, span, edge_span(&graph));
     }
 
-    free(raw);
-    end = clock();
-    dprintf(args.outfd, "[%s] Graph loaded in %.6f seconds with %d nodes and %d edges.\n",
-            timestamp(), (double)(end - start) / CLOCKS_PER_SEC, conr->graph->V, edge_count);
+    if (s->compressed != NULL)
+    {
+        xlog(LOG_INFO, "Adjacency varint encoded, %ld bytes against %ld linked.\n", compressed_bytes(s->compressed),
+                sizeof(struct AdjacencyNode) * s->compressed->edges + sizeof(struct AdjacencyNode *) * (long)s->V);
+        if (s->weighted)
+            xlog(LOG_INFO, "The varint adjacency drops the weights, weighted queries are refused.\n");
+    }
+
+    build_scc(s);
+    // bidirectional Dijkstra walks the reverse too. under -C the landmarks
+    // are built over a temporary one and only prove unreachability.
+    if (s->graph != NULL && (args.landmarks > 0 || s->weighted))
+        s->reverse = reverse_graph(s->graph);
+    if (args.landmarks > 0)
+        build_landmarks(s);
+    if (placed && args.numa == NUMA_REPLICATE)
+        replicate_snapshot(s);
+    else if (placed)
+        numa_set_policy(conr->numa, MPOL_DEFAULT, 0);
+    return s;
+}
+
+void destroy_snapshot(struct Snapshot *s)
+{
+    for (int n = 1; s->replicas != NULL && n < conr->numa->nodes; n++)
+    {
+        destroy_graph(s->replicas[n]);
+        free(s->replicas[n]);
+    }
+    for (int n = 1; s->compressed_replicas != NULL && n < conr->numa->nodes; n++)
+    {
+        destroy_compressed_graph(s->compressed_replicas[n]);
+        free(s->compressed_replicas[n]);
+    }
+    free(s->replicas);
+    free(s->compressed_replicas);
+    if (s->graph != NULL)
+    {
+        destroy_graph(s->graph);
+        free(s->graph);
+    }
+    if (s->compressed != NULL)
+    {
+        destroy_compressed_graph(s->compressed);
+        free(s->compressed);
+    }
+    free(s->perm);
+    free(s->sequence);
+    if (s->scc != NULL)
+    {
+        destroy_scc_index(s->scc);
+        free(s->scc);
+    }
+    if (s->reverse != NULL)
+    {
+        destroy_graph(s->reverse);
+        free(s->reverse);
+    }
+    if (s->landmarks != NULL)
+    {
+        destroy_landmark_index(s->landmarks);
+        free(s->landmarks);
+    }
+    if (s->cache != NULL)
+    {
+        destroy_cache(s->cache);
+        free(s->cache);
+    }
+    destroy_distance_cache(s->distances);
+    free(s->distances);
+}
+
+/* loads the input file again. the new snapshot is built while the old one
+ * keeps serving, the write lock then waits for the searches in flight to
+ * drain and the old snapshot, cache included, is freed once it is swapped
+ * out. FALSE if the file cannot be opened or loaded, the old one stays then. */
+int reload_graph()
+{
+    xlog(LOG_INFO, "SIGHUP received, reloading %s.\n", args.input);
+    int fd = open(args.input, O_RDONLY);
+    if (fd == -1)
+    {
+        xlog(LOG_ERROR, "Cannot open %s (errno %d), still serving generation %d.\n",
+             args.input, errno, conr->snapshot->generation);
+        return FALSE;
+    }
+    long start = monotonic_us();
+    struct Snapshot *next = load_snapshot(fd);
+    if (next == NULL)
+    {
+        xlog(LOG_ERROR, "Still serving generation %d.\n", conr->snapshot->generation);
+        return FALSE;
+    }
+
+    write_lock(&conr->graph_lock);
+    long drained = monotonic_us();
+    struct Snapshot *old = conr->snapshot;
+    next->generation = old->generation + 1;
+    conr->snapshot = next;
+    if (conr->shared != NULL) // workers still on the old graph stop using it.
+        adopt_shared_cache(conr->shared, next->signature);
+    write_unlock(&conr->graph_lock);
+
+    destroy_snapshot(old);
+    free(old);
+    stats_count(&conr->stats->reloads);
+    xlog(LOG_INFO, "Generation %d is serving, built in %ld us, old one freed in %ld us.\n",
+         next->generation, drained - start, monotonic_us() - drained);
+    if (conr->warming) // the new cache starts empty, warm it over again.
+    {
+        stop_warming();
+        start_warming();
+    }
+    return TRUE;
+}
+
+/* takes SIGHUP for a single process server. */
+void *graph_reloader(void *p)
+{
+    (void)p;
+    sigset_t set; // SIGHUP is blocked everywhere, @see become_daemon.
+    sigemptyset(&set);
+    sigaddset(&set, SIGHUP);
+    while (TRUE)
+    {
+        int sig;
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+        if (sigwait(&set, &sig) != 0)
+            xerror(__func__, "sigwait");
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL); // shutdown waits for a reload to finish.
+        reload_graph();
+    }
+    return NULL;
+}
+
+void start_helpers()
+{
+    if (!args.compressed && args.helpers > 0)
+        conr->team = create_bfs_team(args.helpers);
+}
+
+void read_graph()
+{
+    if (args.numa != NUMA_NONE || args.pin)
+        xlog(LOG_INFO, "%d NUMA nodes with cpus, the first has %d.\n",
+             conr->numa->nodes, CPU_COUNT(&conr->numa->cpus[0]));
+    if ((conr->snapshot = load_snapshot(args.infd)) == NULL)
+    {
+        delete_sem();
+        log_stop();
+        exit(EXIT_FAILURE);
+    }
+    if (args.shared_cache > 0)
+    {
+        char name[SHARED_NAME_BYTE];
+        snprintf(name, SHARED_NAME_BYTE, "/graph-cache-%d", args.port);
+        conr->shared = attach_shared_cache(name, (long)args.shared_cache << 20);
+        int warm = adopt_shared_cache(conr->shared, conr->snapshot->signature);
+        xlog(LOG_INFO, "Shared cache %s attached %s with %ld paths.\n",
+             name, warm ? "warm" : "cold", shared_entries(conr->shared));
+    }
+    if (args.workers > 0) // threads do not survive fork, @see spawn_worker.
+        return;
+    start_helpers();
+    xthread_create(&conr->reloader, graph_reloader, NULL);
+}
+
+/* forks worker id and returns its pid. the worker serves from its copy on
+ * write view of the master's memory and never returns. */
+pid_t spawn_worker(int id)
+{
+    pid_t pid = fork();
+    if (pid == -1)
+        xerror(__func__, "fork");
+    if (pid > 0)
+        return pid;
+
+    worker = id;
+    log_after_fork();
+    sigset_t set; // SIGHUP stays blocked, the master handles reloads.
+    sigemptyset(&set);
+    sigaddset(&set, SIGCHLD);
+    pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+    start_terminator(); // SIGINT from the master, threads do not survive fork.
+    start_helpers();
+    xlog(LOG_INFO, "Worker %d started with pid %d on generation %d.\n",
+         id, getpid(), conr->snapshot->generation);
+    create_pool();
+    start_warming();
+    connection_listener();
+    exit(EXIT_SUCCESS);
+}
+
+/* the master with -w: forks the workers, restarts the ones that die,
+ * reloads the graph on SIGHUP and then restarts the workers one at a time
+ * so the others keep the port served. on SIGINT it waits for all of them
+ * and exits. */
+void supervise_workers()
+{
+    int n = args.workers;
+    pid_t *pids = (pid_t *)xmalloc(sizeof(pid_t) * n);
+    long *spawned_at = (long *)xmalloc(sizeof(long) * n);
+    int stopping = FALSE, alive = 0, rolling = -1; // rolling: worker being restarted after a reload.
+
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGHUP);
+    sigaddset(&set, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+    signal(SIGCHLD, SIG_DFL); // ignoring it would reap the workers behind waitpid's back.
+
+    for (int i = 0; i < n; i++)
+    {
+        spawned_at[i] = monotonic_us();
+        pids[i] = spawn_worker(i + 1);
+        alive++;
+    }
+    xlog(LOG_INFO, "Master %d supervising %d workers.\n", getpid(), n);
+
+    while (!stopping || alive > 0)
+    {
+        int sig;
+        if (sigwait(&set, &sig) != 0)
+            xerror(__func__, "sigwait");
+        if (sig == SIGINT && !stopping)
+        {
+            xlog(LOG_INFO, "Termination signal received, stopping %d workers.\n", alive);
+            stopping = TRUE;
+            for (int i = 0; i < n; i++)
+                if (pids[i] > 0)
+                    kill(pids[i], SIGINT);
+        }
+        else if (sig == SIGHUP && !stopping && rolling == -1 && reload_graph())
+        {
+            rolling = 0;
+            kill(pids[0], SIGINT);
+        }
+        else if (sig == SIGCHLD)
+        {
+            pid_t pid;
+            int status;
+            while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+            {
+                int i = 0;
+                while (i < n && pids[i] != pid)
+                    i++;
+                if (i == n)
+                    continue;
+                alive--;
+                pids[i] = 0;
+                if (stopping)
+                    continue;
+                if (i == rolling)
+                    xlog(LOG_INFO, "Worker %d stopped for the reload.\n", i + 1);
+                else if (WIFSIGNALED(status))
+                    xlog(LOG_ERROR, "Worker %d (pid %d) killed by signal %d, restarting it.\n",
+                         i + 1, pid, WTERMSIG(status));
+                else
+                    xlog(LOG_ERROR, "Worker %d (pid %d) exited with status %d, restarting it.\n",
+                         i + 1, pid, WEXITSTATUS(status));
+                if (i != rolling && monotonic_us() - spawned_at[i] < WORKER_RESPAWN_US)
+                    usleep(WORKER_RESPAWN_US); // it died at once, do not spin on e.g. a taken port.
+
+                spawned_at[i] = monotonic_us();
+                pids[i] = spawn_worker(i + 1);
+                alive++;
+                if (i == rolling)
+                {
+                    rolling = i + 1 < n ? i + 1 : -1;
+                    if (rolling != -1)
+                        kill(pids[rolling], SIGINT);
+                }
+            }
+        }
+    }
+
+    xlog(LOG_INFO, "All workers have exited, server shutting down.\n");
+    free(pids);
+    free(spawned_at);
+    delete_sem();
+    log_stop();
+    destroy_shared_resources();
+    exit(EXIT_SUCCESS);
 }
 
 void create_sem()
@@ -291,6 +765,9 @@ void connection_listener()
     int optval = 1;
     if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(int)) == -1)
         xerror(__func__, "setsockopt");
+    // workers each bind the port, the kernel spreads the connections over them.
+    if (worker > 0 && setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(int)) == -1)
+        xerror(__func__, "setsockopt");
 
     host_addr.sin_family = AF_INET;
     host_addr.sin_port = htons(args.port);
@@ -300,7 +777,7 @@ void connection_listener()
     if (bind(sockfd, (struct sockaddr *)&host_addr, sizeof(struct sockaddr)) == -1)
         xerror(__func__, "bind");
 
-    if (listen(sockfd, 20) == -1)
+    if (listen(sockfd, args.backlog) == -1)
         xerror(__func__, "listen");
 
     while (TRUE)
@@ -309,40 +786,718 @@ void connection_listener()
         if ((clientfd = accept(sockfd, (struct sockaddr *)&client_addr, &len)) == -1)
             xerror(__func__, "accept");
 
-        xsem_wait(conr->graph_mutex);
-        enqueue(&conr->client_queue, clientfd);
-        xsem_post(conr->graph_mutex);
+        if (clientfd >= conr->max_fd)
+        {
+            xlog(LOG_ERROR, "Client fd %d over the open file limit, dropping it.\n", clientfd);
+            close(clientfd);
+            continue;
+        }
+        conr->accepted_at[clientfd] = monotonic_us();
 
-        /* forward connection */
-        xsem_post(conr->handler_sem);
+        /* forward connection, wakes up a parked handler if there is one. with
+         * -Q a full queue turns it away instead of holding up accept(). */
+        int target;
+        if (args.queue_limit == 0)
+        {
+            if (!sched_submit(conr->scheduler, clientfd))
+                close(clientfd);
+        }
+        else if (sched_size(conr->scheduler) >= args.queue_limit ||
+                 !sched_try_submit(conr->scheduler, clientfd, &target))
+        {
+            stats_count(&conr->stats->refused);
+            refuse_connection(clientfd);
+        }
     }
     exit(EXIT_SUCCESS);
 }
 
-char *prepare_packet(struct Queue *bfs);
+/* a client that hung up loses its reply, the daemon carries on. */
+void send_reply(int nth, int clientfd, const void *buf, int len)
+{
+    if (!send_full(clientfd, buf, len))
+        xlog(LOG_INFO, "Thread #%d: client hung up before the reply.\n", nth);
+}
+
+/* answers BUSY_REPLY without reading the query and closes. the client may
+ * be gone already, nothing here fails on it. */
+void refuse_connection(int clientfd)
+{
+    send(clientfd, BUSY_REPLY, strlen(BUSY_REPLY), MSG_NOSIGNAL | MSG_DONTWAIT);
+    shutdown(clientfd, SHUT_WR);
+    char drain[256]; // unread bytes would turn the close into a reset.
+    while (recv(clientfd, drain, sizeof(drain), MSG_DONTWAIT) > 0)
+        ;
+    close(clientfd);
+}
 
-long read_database(int i, int j);
-void write_database(char *path, int i, int j);
+/* a handler's reply, grown as needed and reused for every request */
+struct Buffer
+{
+    char *data;
+    int cap;
+};
+
+char *prepare_packet(struct Queue *bfs, long cost, struct Buffer *out);
+char *prepare_paths(struct YenPath *paths, int n, struct Buffer *out);
+
+long read_database(int i, int j, int kind);
+void write_database(const char *path, int i, int j, int kind);
+void record_query(struct Packet *query);
 float get_load();
 int need_resize(float);
 
+/* internal id of a vertex of the input file. */
+int internal_id(int v)
+{
+    return conr->snapshot->perm != NULL ? conr->snapshot->perm[v] : v;
+}
+
+/* TRUE if there is certainly no path, decided without touching the cache or the graph. */
+int no_path(struct Packet *indices)
+{
+    unsigned int V = conr->snapshot->V;
+    if (indices->i1 >= V || indices->i2 >= V)
+        return TRUE;
+    int start = internal_id(indices->i1), end = internal_id(indices->i2);
+    if (scc_unreachable(conr->snapshot->scc, start, end))
+        return TRUE;
+    return conr->snapshot->landmarks != NULL && landmark_unreachable(conr->snapshot->landmarks, start, end);
+}
+
+/* the copy of the adjacency on the node the caller runs on, the only one without -N replicate. */
+struct Graph *local_graph()
+{
+    struct Snapshot *s = conr->snapshot;
+    return s->replicas != NULL ? s->replicas[numa_current_node(conr->numa)] : s->graph;
+}
+
+struct CompressedGraph *local_compressed()
+{
+    struct Snapshot *s = conr->snapshot;
+    return s->compressed_replicas != NULL ? s->compressed_replicas[numa_current_node(conr->numa)] : s->compressed;
+}
+
+/* shortest path between internal ids with whatever the graph was loaded with. */
+struct Queue *find_path(int source, int target, struct SearchStats *search)
+{
+    if (conr->snapshot->compressed != NULL)
+        return bfs_compressed(local_compressed(), source, target, search);
+    if (conr->snapshot->landmarks != NULL)
+        return landmark_search(local_graph(), conr->snapshot->reverse, conr->snapshot->landmarks, source, target,
+                               search);
+    if (conr->team != NULL)
+        return bfs_parallel(conr->team, local_graph(), source, target, search);
+    return bfs_bitmap(local_graph(), source, target, search);
+}
+
+/* cost minimal path between internal ids, its cost into *cost. without a
+ * weight column every edge costs 1 and the hop minimal path is the answer. */
+struct Queue *find_weighted_path(int source, int target, long *cost, struct SearchStats *search)
+{
+    if (!conr->snapshot->weighted)
+    {
+        struct Queue *path = find_path(source, target, search);
+        if (path != NULL)
+            *cost = size(path) - 1;
+        return path;
+    }
+    if (conr->snapshot->reverse != NULL)
+        return dijkstra_bidirectional(local_graph(), conr->snapshot->reverse, source, target, cost, search);
+    return dijkstra(local_graph(), source, target, cost, search);
+}
+
+/* hops between internal ids, -1 if unreachable. the landmarks answer when
+ * their bounds meet, else a BFS that keeps no parents. */
+int find_distance(int source, int target, struct SearchStats *search)
+{
+    if (conr->snapshot->landmarks != NULL)
+    {
+        int lower = landmark_lower(conr->snapshot->landmarks, source, target);
+        if (lower == LANDMARK_UNREACHABLE)
+            return -1;
+        if (lower == landmark_upper(conr->snapshot->landmarks, source, target))
+            return lower;
+    }
+    if (conr->snapshot->compressed != NULL)
+        return bfs_compressed_hops(local_compressed(), source, target, search);
+    return bfs_hops(local_graph(), source, target, search);
+}
+
+/* up to k cheapest loopless paths between internal ids, formatted into out.
+ * returns how many were found. */
+int find_paths(int source, int target, int k, struct Buffer *out, struct SearchStats *search)
+{
+    struct YenPath paths[YEN_MAX_K];
+    int n = yen_paths(local_graph(), source, target, k, paths, search);
+    prepare_paths(paths, n, out);
+    destroy_yen_paths(paths, n);
+    return n;
+}
+
+/* a search for clientfd gives up at the timeout of its packet, counted from
+ * accept(), or as soon as the client hangs up. */
+struct SearchStats search_limits(int clientfd, struct Packet *indices)
+{
+    long deadline = indices->timeout_ms > 0 ? conr->accepted_at[clientfd] + indices->timeout_ms * 1000L : LONG_MAX;
+    struct SearchStats search = {0, 0, deadline, clientfd, FALSE};
+    return search;
+}
+
+void search_timed_out(int nth, int clientfd, struct Packet *indices, struct SearchStats *search)
+{
+    stats_count(&conr->stats->timeouts);
+    xlog(LOG_INFO, "Thread #%d: search from node %d to %d given up after %ld vertices.\n",
+         nth, indices->i1, indices->i2, search->vertices);
+    send(clientfd, TIMEOUT_REPLY, strlen(TIMEOUT_REPLY), MSG_NOSIGNAL); // the client may be gone.
+}
+
+/* the graph is read locked by the caller, cached paths stay valid until it is released.
+ * serves QUERY_PATH, QUERY_WEIGHTED and QUERY_KPATHS, cached apart by kind. */
+void serve_path(int nth, int clientfd, struct Packet *indices, int kind, struct Buffer *reply)
+{
+    if (conr->snapshot->graph == NULL &&
+        ((kind == QUERY_WEIGHTED && conr->snapshot->weighted) || indices->type == QUERY_KPATHS))
+    {
+        char error[] = "weighted or alternative paths are not possible with a compressed graph.";
+        send_reply(nth, clientfd, error, strlen(error));
+        return;
+    }
+    stats_count(&conr->stats->requests);
+    if (no_path(indices))
+    {
+        stats_count(&conr->stats->unreachable);
+        char *path = prepare_packet(NULL, -1, reply);
+        xlog(LOG_INFO, "Thread #%d: %s from node %d to %d (index).\n",
+             nth, path, indices->i1, indices->i2);
+        long start = monotonic_us();
+        send_reply(nth, clientfd, path, strlen(path));
+        hist_record(&conr->stats->send, monotonic_us() - start);
+        return;
+    }
+
+    xlog(LOG_DEBUG, "Thread #%d: searching database for a path from node %d to node %d\n",
+         nth, indices->i1, indices->i2);
+    long start = monotonic_us();
+    long in_cache = read_database(indices->i1, indices->i2, kind);
+    hist_record(&conr->stats->cache_lookup, monotonic_us() - start);
+    char *path;
+    if (in_cache)
+    {
+        stats_count(&conr->stats->hits);
+        path = (char *)in_cache;
+        xlog(LOG_INFO, "Thread #%d: path found in database: %s\n",
+             nth, path);
+    }
+    else
+    {
+        // find the path.
+        stats_count(&conr->stats->misses);
+        xlog(LOG_DEBUG, "Thread #%d: no path in database, calculating %d->%d\n",
+             nth, indices->i1, indices->i2);
+        int source = internal_id(indices->i1), target = internal_id(indices->i2), found;
+        struct SearchStats search = search_limits(clientfd, indices);
+        start = monotonic_us();
+        if (indices->type == QUERY_KPATHS)
+        {
+            found = find_paths(source, target, kind >> KIND_SHIFT, reply, &search);
+            hist_record(&conr->stats->bfs, monotonic_us() - start);
+            path = reply->data;
+        }
+        else
+        {
+            long cost = -1;
+            struct Queue *bfs = kind == QUERY_WEIGHTED ? find_weighted_path(source, target, &cost, &search)
+                                                       : find_path(source, target, &search);
+            hist_record(&conr->stats->bfs, monotonic_us() - start);
+            path = prepare_packet(bfs, cost, reply);
+            if ((found = bfs != NULL))
+            {
+                destroy_queue(bfs);
+                free(bfs);
+            }
+        }
+
+        if (search.cancelled) // neither an answer nor worth caching.
+        {
+            search_timed_out(nth, clientfd, indices, &search);
+            return;
+        }
+        if (!found)
+            xlog(LOG_INFO, "Thread #%d: %s from node %d to %d.\n",
+                 nth, path, indices->i1, indices->i2);
+        else
+            xlog(LOG_INFO, "Thread #%d: path calculated: %s\n",
+                 nth, path);
+
+        write_database(path, indices->i1, indices->i2, kind);
+        xlog(LOG_DEBUG, "Thread #%d: responding to client and adding path to database\n",
+             nth);
+    }
+
+    start = monotonic_us();
+    int len = strlen(path);
+    send_reply(nth, clientfd, path, len);
+    hist_record(&conr->stats->send, monotonic_us() - start);
+    if (in_cache && conr->shared != NULL) // a copy, the segment keeps its own.
+        free(path);
+}
+
+/* QUERY_REACH and QUERY_DISTANCE: the hops alone, from the indexes or the
+ * distance cache when they know, and never formatted as a path. a pair in
+ * one component is reachable without finding out how far. the graph is
+ * read locked by the caller. */
+void serve_distance(int nth, int clientfd, struct Packet *indices)
+{
+    stats_count(&conr->stats->requests);
+    int reach = indices->type == QUERY_REACH, distance;
+    long start = monotonic_us();
+    if (no_path(indices))
+    {
+        stats_count(&conr->stats->unreachable);
+        distance = -1;
+    }
+    else if (reach && scc_same(conr->snapshot->scc, internal_id(indices->i1), internal_id(indices->i2)))
+        distance = 0; // only its sign is sent.
+    else if (get_distance(conr->snapshot->distances, indices->i1, indices->i2, &distance))
+    {
+        stats_count(&conr->stats->hits);
+        hist_record(&conr->stats->cache_lookup, monotonic_us() - start);
+    }
+    else
+    {
+        stats_count(&conr->stats->misses);
+        hist_record(&conr->stats->cache_lookup, monotonic_us() - start);
+        struct SearchStats search = search_limits(clientfd, indices);
+        start = monotonic_us();
+        distance = find_distance(internal_id(indices->i1), internal_id(indices->i2), &search);
+        hist_record(&conr->stats->bfs, monotonic_us() - start);
+        if (search.cancelled)
+        {
+            search_timed_out(nth, clientfd, indices, &search);
+            return;
+        }
+        put_distance(conr->snapshot->distances, indices->i1, indices->i2, distance);
+    }
+
+    char reply[UPDATE_REPLY_BYTE];
+    int len = reach ? snprintf(reply, UPDATE_REPLY_BYTE, distance >= 0 ? "reachable." : "unreachable.")
+                    : snprintf(reply, UPDATE_REPLY_BYTE, "%d.", distance);
+    xlog(LOG_INFO, "Thread #%d: %s from node %d to %d.\n", nth, reply, indices->i1, indices->i2);
+    start = monotonic_us();
+    send_reply(nth, clientfd, reply, len);
+    hist_record(&conr->stats->send, monotonic_us() - start);
+}
+
+/* the last WARM_MAX_PAIRS pairs of the -W file. with -R the file is cut
+ * down to them and kept open, samples are appended with one write each, so
+ * the workers can share it. */
+void read_warm_pairs()
+{
+    if (args.warm == NULL)
+        return;
+    FILE *fp = fopen(args.warm, "r");
+    if (fp != NULL)
+    {
+        struct Packet *ring = (struct Packet *)xmalloc(sizeof(struct Packet) * WARM_MAX_PAIRS);
+        long lines = 0;
+        char line[64];
+        unsigned int src, dst;
+        while (fgets(line, sizeof(line), fp) != NULL)
+            if (line[0] != '#' && sscanf(line, "%u %u", &src, &dst) == 2)
+                ring[lines++ % WARM_MAX_PAIRS] = (struct Packet){QUERY_PATH, src, dst, 0};
+        fclose(fp);
+        conr->warm_count = lines < WARM_MAX_PAIRS ? lines : WARM_MAX_PAIRS;
+        conr->warm = (struct Packet *)xmalloc(sizeof(struct Packet) * max(conr->warm_count, 1));
+        for (int k = 0; k < conr->warm_count; k++)
+            conr->warm[k] = ring[(lines - conr->warm_count + k) % WARM_MAX_PAIRS];
+        free(ring);
+    }
+    else if (errno != ENOENT || args.record == 0) // a missing file is created for -R.
+        xlog(LOG_ERROR, "Cannot open %s (errno %d), the cache starts cold.\n", args.warm, errno);
+
+    if (args.record > 0)
+    {
+        if ((fp = fopen(args.warm, "w")) != NULL)
+        {
+            for (int k = 0; k < conr->warm_count; k++)
+                fprintf(fp, "%u\t%u\n", conr->warm[k].i1, conr->warm[k].i2);
+            fclose(fp);
+            conr->record_fd = open(args.warm, O_WRONLY | O_APPEND);
+        }
+        if (conr->record_fd == -1)
+            xlog(LOG_ERROR, "Cannot write %s (errno %d), queries are not recorded.\n", args.warm, errno);
+    }
+    xlog(LOG_INFO, "%d pairs to warm the cache with read from %s.\n", conr->warm_count, args.warm);
+}
+
+/* appends 1 of every -R path queries to the -W file, at most WARM_MAX_PAIRS a run. */
+void record_query(struct Packet *query)
+{
+    if (conr->record_fd == -1 || atomic_fetch_add(&conr->seen, 1) % args.record != 0 ||
+        atomic_fetch_add(&conr->recorded, 1) >= WARM_MAX_PAIRS)
+        return;
+    char line[32];
+    int len = snprintf(line, sizeof(line), "%u\t%u\n", query->i1, query->i2);
+    if (write(conr->record_fd, line, len) != len)
+        xlog(LOG_ERROR, "Cannot append to %s (errno %d).\n", args.warm, errno);
+}
+
+/* computes the path of query into the cache unless it is there already or
+ * certainly does not exist. the graph is read locked by the caller. */
+void warm_path(struct Packet *query, struct Buffer *reply)
+{
+    if (no_path(query))
+        return;
+    long in_cache = read_database(query->i1, query->i2, QUERY_PATH);
+    if (in_cache)
+    {
+        if (conr->shared != NULL)
+            free((char *)in_cache);
+        return;
+    }
+    struct SearchStats search = {0, 0, monotonic_us() + WARM_SEARCH_US, -1, FALSE};
+    struct Queue *bfs = find_path(internal_id(query->i1), internal_id(query->i2), &search);
+    if (!search.cancelled)
+    {
+        write_database(prepare_packet(bfs, -1, reply), query->i1, query->i2, QUERY_PATH);
+        stats_count(&conr->stats->warmed);
+    }
+    if (bfs != NULL)
+    {
+        destroy_queue(bfs);
+        free(bfs);
+    }
+}
+
+/* takes pairs most recent first. it runs on cores nothing else wants and
+ * steps aside while connections are queued, so clients only share the
+ * graph lock with it. */
+void *cache_warmer(void *p)
+{
+    (void)p;
+    sigset_t set; // signals belong to the handler threads.
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+    struct sched_param param = {0};
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+
+    struct Buffer reply = {NULL, 0};
+    int k;
+    while (!atomic_load(&conr->warm_stop) && !atomic_load(&conr->cache_full) &&
+           (k = atomic_fetch_add(&conr->warm_next, 1)) < conr->warm_count)
+    {
+        while (sched_size(conr->scheduler) > 0 && !atomic_load(&conr->warm_stop))
+            usleep(WARM_BACKOFF_US);
+        read_lock(&conr->graph_lock);
+        warm_path(&conr->warm[conr->warm_count - 1 - k], &reply);
+        read_unlock(&conr->graph_lock);
+    }
+    free(reply.data);
+    return NULL;
+}
+
+/* with -M the first worker warms the shared cache for everyone. */
+void start_warming()
+{
+    if (conr->warm_count == 0 || (conr->shared != NULL && worker > 1))
+        return;
+    atomic_store(&conr->warm_next, 0);
+    atomic_store(&conr->warm_stop, FALSE);
+    for (int t = 0; t < WARM_THREADS; t++)
+        xthread_create(&conr->warmers[t], cache_warmer, NULL);
+    conr->warming = TRUE;
+}
+
+/* waits for the search each warmer is in, warming is not resumed. */
+void stop_warming()
+{
+    if (!conr->warming)
+        return;
+    atomic_store(&conr->warm_stop, TRUE);
+    for (int t = 0; t < WARM_THREADS; t++)
+        xthread_join(conr->warmers[t]);
+    conr->warming = FALSE;
+}
+
+void serve_stats(int nth, int clientfd)
+{
+    xlog(LOG_DEBUG, "Thread #%d: sending statistics\n", nth);
+    char buf[STATS_MAX_BYTE];
+
+    xsem_wait(dynr->load_mutex);
+    int len = snprintf(buf, STATS_MAX_BYTE, "pool_size %d\nbusy %d\nqueued %d\n",
+                       dynr->n - 1, dynr->handler_count, sched_size(conr->scheduler));
+    xsem_post(dynr->load_mutex);
+    if (worker > 0) // every worker counts its own requests.
+        len += snprintf(buf + len, STATS_MAX_BYTE - len, "worker %d\n", worker);
+    if (conr->shared != NULL)
+        len += snprintf(buf + len, STATS_MAX_BYTE - len, "shared_paths %ld\nshared_wipes %ld\n",
+                        shared_entries(conr->shared), shared_wipes(conr->shared));
+    else
+    {
+        read_lock(&conr->graph_lock); // a reload frees the snapshot's cache.
+        struct Cache *cache = conr->snapshot->cache;
+        len += snprintf(buf + len, STATS_MAX_BYTE - len, "cache_paths %ld\ncache_bytes %ld\ncache_reserved %ld\n",
+                        atomic_load(&cache->entries), atomic_load(&cache->used), atomic_load(&cache->reserved));
+        read_unlock(&conr->graph_lock);
+    }
+    read_lock(&conr->graph_lock);
+    len += snprintf(buf + len, STATS_MAX_BYTE - len, "cache_distances %ld\n",
+                    atomic_load(&conr->snapshot->distances->entries));
+    read_unlock(&conr->graph_lock);
+    len += stats_format(conr->stats, buf + len, STATS_MAX_BYTE - len);
+    send_reply(nth, clientfd, buf, len);
+}
+
+/* number of hops of a cached "a->b->c." or "a->b->c, cost n." path, -1 for
+ * "path not possible.". */
+int path_hops(const char *path)
+{
+    int hops = 0;
+    if (!isdigit((unsigned char)path[0]))
+        return -1;
+    for (const char *p = path; (p = strstr(p, "->")) != NULL; p += 2)
+        hops++;
+    return hops;
+}
+
+/* TRUE if the cached path, or any line of a k paths answer, walks the edge from->to. */
+int path_uses_edge(const char *path, struct Edge *edge)
+{
+    if (!isdigit((unsigned char)path[0]))
+        return FALSE;
+    long prev = -1;
+    for (const char *p = path; *p != '\0' && *p != '.';)
+    {
+        char *next;
+        long v = strtol(p, &next, 10);
+        if (prev == edge->from && v == edge->to)
+            return TRUE;
+        prev = v;
+        p = next;
+        if (strncmp(p, "->", 2) == 0)
+            p += 2;
+        else if ((p = strchr(p, '\n')) != NULL) // the next path.
+        {
+            p++;
+            prev = -1;
+        }
+        else
+            break;
+    }
+    return FALSE;
+}
+
+/* what an applied batch may have made stale in the cache */
+struct Invalidation
+{
+    struct Edge *edges; // applied edges, input file ids.
+    int n;
+    int add;
+    struct Edge *added; // with add: the edge dist is for.
+    int *dist;          // with add: hops from added->to on the updated graph, internal ids.
+};
+
+/* dist: cached hops from i to j, -1 if unreachable. */
+int stale_distance(int i, int j, int dist, void *arg)
+{
+    struct Invalidation *inv = (struct Invalidation *)arg;
+    if (inv->n > UPDATE_SCAN_EDGES)
+        return TRUE;
+    if (!inv->add) // it may have been on the way, an unreachable pair stays so.
+        return dist != -1;
+
+    // an added from->to may only help if j is reachable from to, and then a
+    // path through it has at least (i != from) + 1 + dist[j] hops.
+    int rest = inv->dist[internal_id(j)];
+    return rest != -1 && (dist == -1 || dist > (i != (int)inv->added->from) + 1 + rest);
+}
+
+int stale_path(int i, int j, int kind, char *path, void *arg)
+{
+    struct Invalidation *inv = (struct Invalidation *)arg;
+    if (inv->n > UPDATE_SCAN_EDGES)
+        return TRUE;
+    if (!inv->add) // a removal only breaks the paths that walk it.
+    {
+        for (int k = 0; k < inv->n; k++)
+            if (path_uses_edge(path, &inv->edges[k]))
+                return TRUE;
+        return FALSE;
+    }
+
+    // hops say nothing about costs, nor about the k-th path: any such answer
+    // goes if the added edge can lead to j.
+    if (kind != QUERY_PATH)
+        return inv->dist[internal_id(j)] != -1;
+    return stale_distance(i, j, path_hops(path), arg);
+}
+
+int evict_database(struct Invalidation *inv)
+{
+    int evicted = evict_distances_if(conr->snapshot->distances, stale_distance, inv);
+    if (conr->shared != NULL)
+        return evicted + evict_shared_cache_if(conr->shared, stale_path, inv);
+    return evicted + evict_cache_if(conr->snapshot->cache, stale_path, inv);
+}
+
+/* evicts the cached paths the batch may have changed, returns how many.
+ * the graph is write locked, so no search result can be cached meanwhile. */
+int invalidate_database(struct Invalidation *inv)
+{
+    // writer is entering the house.
+    xsem_wait(conr->write_mutex);
+    conr->write_count++;
+    if (conr->write_count == 1)
+        xsem_wait(conr->read_try);
+    xsem_post(conr->write_mutex);
+    xsem_wait(conr->cache_mutex);
+
+    int evicted = 0;
+    if (!inv->add || inv->n > UPDATE_SCAN_EDGES)
+        evicted = evict_database(inv);
+    else
+        for (int k = 0; k < inv->n; k++)
+        {
+            inv->added = &inv->edges[k];
+            inv->dist = bfs_distances(conr->snapshot->graph, internal_id(inv->added->to));
+            evicted += evict_database(inv);
+            free(inv->dist);
+        }
+
+    xsem_post(conr->cache_mutex);
+    // writer is leaving the house.
+    xsem_wait(conr->write_mutex);
+    conr->write_count--;
+    if (conr->write_count == 0)
+        xsem_post(conr->read_try);
+    xsem_post(conr->write_mutex);
+    return evicted;
+}
+
+/* applies the edges of a batch the primary copy took to the other copies of
+ * -N replicate, each bound to its node as replicate_snapshot copied it. */
+void update_replicas(struct Edge *edges, int count, int add)
+{
+    for (int n = 1; n < conr->numa->nodes; n++)
+    {
+        numa_set_policy(conr->numa, MPOL_BIND, n);
+        for (int k = 0; k < count; k++)
+        {
+            int u = internal_id(edges[k].from), v = internal_id(edges[k].to);
+            if (add)
+                add_edge(conr->snapshot->replicas[n], u, v);
+            else
+                remove_edge(conr->snapshot->replicas[n], u, v);
+        }
+    }
+    numa_set_policy(conr->numa, MPOL_DEFAULT, 0);
+}
+
+/* applies a batch of edges to the graph and rebuilds what it made unsound:
+ * the component index when an added edge joins pairs it called unreachable
+ * or a removed one ran inside a component (any other edge keeps its answers
+ * true), the landmarks when a label got shorter or any edge was removed. */
+void serve_update(int nth, int clientfd, struct Packet *packet)
+{
+    int add = packet->type == QUERY_ADD;
+    char reply[UPDATE_REPLY_BYTE];
+    if (args.compressed || args.workers > 0 || packet->i1 > UPDATE_MAX_EDGES) // unsigned, before it fits an int.
+    {
+        int len = snprintf(reply, UPDATE_REPLY_BYTE, args.compressed
+                           ? "updates are not possible with a compressed graph."
+                           : args.workers > 0 ? "updates are not possible with worker processes."
+                           : "too many edges, at most %d in a batch.", UPDATE_MAX_EDGES);
+        send_reply(nth, clientfd, reply, len);
+        return;
+    }
+    int count = packet->i1;
+    struct Edge *edges = (struct Edge *)xmalloc(sizeof(struct Edge) * (count + 1));
+    if (!xread_full(clientfd, edges, sizeof(struct Edge) * count))
+    {
+        xlog(LOG_ERROR, "Thread #%d: update batch of %d edges cut short\n", nth, count);
+        free(edges);
+        return;
+    }
+
+    long start = monotonic_us();
+    write_lock(&conr->graph_lock);
+    if (conr->snapshot->replicas != NULL) // the primary copy and what derives from it live on the first node.
+        numa_set_policy(conr->numa, MPOL_BIND, 0);
+    int applied = 0, scc_stale = FALSE, landmarks_stale = FALSE;
+    for (int k = 0; k < count; k++)
+    {
+        if (edges[k].from >= (unsigned int)conr->snapshot->V || edges[k].to >= (unsigned int)conr->snapshot->V)
+            continue;
+        int u = internal_id(edges[k].from), v = internal_id(edges[k].to);
+        if (add)
+        {
+            scc_stale |= scc_unreachable(conr->snapshot->scc, u, v);
+            landmarks_stale |= conr->snapshot->landmarks != NULL && landmark_shortens(conr->snapshot->landmarks, u, v);
+            add_edge(conr->snapshot->graph, u, v);
+            if (conr->snapshot->reverse != NULL)
+                add_edge(conr->snapshot->reverse, v, u);
+        }
+        else
+        {
+            if (!remove_edge(conr->snapshot->graph, u, v))
+                continue;
+            if (conr->snapshot->reverse != NULL)
+                remove_edge(conr->snapshot->reverse, v, u);
+            // only an edge inside a component can split it, reach queries trust scc_same().
+            scc_stale |= scc_same(conr->snapshot->scc, u, v);
+            landmarks_stale = conr->snapshot->landmarks != NULL;
+        }
+        edges[applied++] = edges[k];
+    }
+    if (scc_stale)
+        build_scc(conr->snapshot);
+    if (landmarks_stale)
+        build_landmarks(conr->snapshot);
+    if (conr->snapshot->replicas != NULL)
+        update_replicas(edges, applied, add);
+    struct Invalidation inv = {edges, applied, add, NULL, NULL};
+    int invalidated = applied > 0 ? invalidate_database(&inv) : 0;
+    if (conr->shared != NULL && applied > 0)
+        conr->snapshot->signature = retag_shared_cache(conr->shared, conr->snapshot->signature);
+    write_unlock(&conr->graph_lock);
+
+    stats_count(&conr->stats->updates);
+    atomic_fetch_add(&conr->stats->invalidated, invalidated);
+    xlog(LOG_INFO, "Thread #%d: %d of %d edges %s in %ld us, %d cached paths invalidated\n",
+         nth, applied, count, add ? "added" : "removed", monotonic_us() - start, invalidated);
+    int len = snprintf(reply, UPDATE_REPLY_BYTE, "%d edges %s, %d ignored, %d cached paths invalidated.",
+                       applied, add ? "added" : "removed", count - applied, invalidated);
+    send_reply(nth, clientfd, reply, len);
+    free(edges);
+}
+
 void *connection_handler(void *p)
 {
 
     int packet_len = sizeof(struct Packet);
     char *recv_packet = xmalloc(packet_len);
+    struct Buffer reply = {NULL, 0};
 
     int *nth = (int *)p;
+    if (args.pin && !numa_pin(conr->numa, (*nth - 1) % conr->numa->nodes))
+        xlog(LOG_ERROR, "Thread #%d: cannot be pinned to node %d.\n", *nth, conr->numa->id[(*nth - 1) % conr->numa->nodes]);
 
     while (TRUE)
     {
-        dprintf(args.outfd, "[%s] Thread #%d: waiting for connection \n", timestamp(), *nth);
-        xsem_wait(conr->handler_sem);
-
-        if (is_finished())
-        {
-            xsem_post(conr->handler_sem);
+        xlog(LOG_DEBUG, "Thread #%d: waiting for connection \n", *nth);
+        long clientfd;
+        if (!sched_take(conr->scheduler, *nth - 1, &clientfd)) // closed and drained, or retired.
             break;
+        long start = monotonic_us();
+        hist_record(&conr->stats->queue_wait, start - conr->accepted_at[clientfd]);
+        if (args.deadline_ms > 0 && start - conr->accepted_at[clientfd] > args.deadline_ms * 1000L)
+        {
+            // its client has likely given up, serving it would only delay the ones behind.
+            stats_count(&conr->stats->expired);
+            refuse_connection(clientfd);
+            continue;
         }
 
         xsem_wait(dynr->load_mutex);
@@ -362,70 +1517,83 @@ void *connection_handler(void *p)
             xsem_post(dynr->load_mutex);
         }
 
-        dprintf(args.outfd, "[%s] A connection has been delegated to thread id #%d, system load %.1f%%\n",
-                timestamp(), *nth, 100 * get_load());
+        xlog(LOG_DEBUG, "A connection has been delegated to thread id #%d, system load %.1f%%\n",
+             *nth, 100 * get_load());
 
-        xsem_wait(conr->graph_mutex);
-        int clientfd = dequeue(conr->client_queue);
-        xsem_post(conr->graph_mutex);
-
-        // get the indexes.
-        xread(clientfd, recv_packet, packet_len);
-        struct Packet *indices = (struct Packet *)recv_packet;
-
-        dprintf(args.outfd, "[%s] Thread #%d: searching database for a path from node %d to node %d\n",
-                timestamp(), *nth, indices->i1, indices->i2);
-        long in_cache = read_database(indices->i1, indices->i2);
-        char *path;
-        if (in_cache)
-        {
-            path = (char *)in_cache;
-            dprintf(args.outfd, "[%s] Thread #%d: path found in database: %s\n",
-                    timestamp(), *nth, path);
-        }
+        // get the query.
+        struct Packet *query = (struct Packet *)recv_packet;
+        if (!xread_full(clientfd, recv_packet, packet_len))
+            xlog(LOG_INFO, "Thread #%d: client hung up before its query.\n", *nth);
         else
-        {
-            // find the path.
-            dprintf(args.outfd, "[%s] Thread #%d: no path in database, calculating %d->%d\n",
-                    timestamp(), *nth, indices->i1, indices->i2);
-            xsem_wait(conr->graph_mutex);
-            struct Queue *bfs = BFS(conr->graph, indices->i1, indices->i2);
-            xsem_post(conr->graph_mutex);
-
-            path = prepare_packet(bfs);
-
-            if (bfs == NULL)
-                dprintf(args.outfd, "[%s] Thread #%d: %s from node %d to %d.\n",
-                        timestamp(), *nth, path, indices->i1, indices->i2);
-            else
+            switch (query->type)
             {
-                destroy_queue(bfs);
-                dprintf(args.outfd, "[%s] Thread #%d: path calculated: %s\n",
-                        timestamp(), *nth, path);
+            case QUERY_PATH:
+            case QUERY_WEIGHTED:
+                if (query->type == QUERY_PATH)
+                    record_query(query);
+                read_lock(&conr->graph_lock);
+                serve_path(*nth, clientfd, query, query->type, &reply);
+                read_unlock(&conr->graph_lock);
+                trim_cache(*nth);
+                break;
+            case QUERY_KPATHS:
+            {
+                unsigned int k;
+                if (!xread_full(clientfd, &k, sizeof(k)))
+                    break;
+                if (k < 1 || k > YEN_MAX_K)
+                {
+                    char error[UPDATE_REPLY_BYTE];
+                    send_reply(*nth, clientfd, error, snprintf(error, UPDATE_REPLY_BYTE, "k is not in range [1, %d].", YEN_MAX_K));
+                    break;
+                }
+                read_lock(&conr->graph_lock);
+                serve_path(*nth, clientfd, query, QUERY_KPATHS | k << KIND_SHIFT, &reply);
+                read_unlock(&conr->graph_lock);
+                trim_cache(*nth);
+                break;
+            }
+            case QUERY_REACH:
+            case QUERY_DISTANCE:
+                read_lock(&conr->graph_lock);
+                serve_distance(*nth, clientfd, query);
+                read_unlock(&conr->graph_lock);
+                break;
+            case QUERY_STATS:
+                serve_stats(*nth, clientfd);
+                break;
+            case QUERY_ADD:
+            case QUERY_REMOVE:
+                serve_update(*nth, clientfd, query);
+                break;
+            default:
+                xlog(LOG_ERROR, "Thread #%d: unknown query type %d\n", *nth, query->type);
+                send_reply(*nth, clientfd, "unknown query.", 14);
+                break;
             }
-
-            write_database(path, indices->i1, indices->i2);
-            dprintf(args.outfd, "[%s] Thread #%d: responding to client and adding path to database\n",
-                    timestamp(), *nth);
-        }
-
-        int len = strlen(path);
-        xwrite(clientfd, path, len);
         close(clientfd);
 
         xsem_wait(dynr->load_mutex);
         dynr->handler_count--;
+        dynr->served++;
+        dynr->service_us += monotonic_us() - start;
         xsem_post(dynr->load_mutex);
     }
 
+    if (!atomic_load(&conr->scheduler->closed))
+        xlog(LOG_INFO, "Thread #%d: retired\n", *nth);
     free(recv_packet);
+    free(reply.data);
     free(nth);
     pthread_exit(NULL);
     return NULL;
 }
 
-long read_database(int i, int j)
+long read_database(int i, int j, int kind)
 {
+    if (conr->shared != NULL) // locked per stripe inside, returns a copy.
+        return (long)get_shared_cache(conr->shared, conr->snapshot->signature, i, j, kind);
+
     // reader is entering the house.
     xsem_wait(conr->read_try);
     xsem_wait(conr->read_mutex);
@@ -436,7 +1604,7 @@ long read_database(int i, int j)
     xsem_post(conr->read_try);
 
     /* start read */
-    long path = get_cache(conr->cache, i, j);
+    long path = get_cache(conr->snapshot->cache, i, j, kind);
     /* end read */
 
     // reader is leaving the house.
@@ -448,8 +1616,15 @@ long read_database(int i, int j)
     return path;
 }
 
-void write_database(char *path, int i, int j)
+void write_database(const char *path, int i, int j, int kind)
 {
+    if (conr->shared != NULL) // copies the path in.
+    {
+        atomic_fetch_add(&conr->stats->evictions,
+                         to_shared_cache(conr->shared, conr->snapshot->signature, i, j, kind, path));
+        return;
+    }
+
     // writer is entering the house.
     xsem_wait(conr->write_mutex);
     conr->write_count++;
@@ -459,7 +1634,8 @@ void write_database(char *path, int i, int j)
     xsem_wait(conr->cache_mutex);
 
     /* write start */
-    to_cache(conr->cache, i, j, path);
+    if (!to_cache(conr->snapshot->cache, i, j, kind, path))
+        atomic_store(&conr->cache_full, TRUE);
     /* write end */
 
     xsem_post(conr->cache_mutex);
@@ -471,20 +1647,50 @@ void write_database(char *path, int i, int j)
     xsem_post(conr->write_mutex);
 }
 
+/* paths handed out by read_database are only valid while the graph is read
+ * locked, so a full cache is cleared under the write lock, like an update's
+ * evictions, by the next handler done with a path query. */
+void trim_cache(int nth)
+{
+    if (!atomic_load(&conr->cache_full))
+        return;
+    write_lock(&conr->graph_lock);
+    if (atomic_exchange(&conr->cache_full, FALSE) && conr->snapshot->cache != NULL)
+    {
+        xsem_wait(conr->cache_mutex);
+        long dropped = clear_cache(conr->snapshot->cache);
+        xsem_post(conr->cache_mutex);
+        atomic_fetch_add(&conr->stats->evictions, dropped);
+        xlog(LOG_INFO, "Thread #%d: path cache reached %d MB, %ld paths dropped.\n", nth, args.cache_limit, dropped);
+    }
+    write_unlock(&conr->graph_lock);
+}
+
 void init_shared_resources()
 {
     conr = xmalloc(sizeof(struct ConnHandlerResource));
     dynr = xmalloc(sizeof(struct DynamicPoolerResource));
 
-    conr->graph = NULL;
-    conr->graph_mutex = xmalloc(sizeof(sem_t));
-    conr->handler_sem = xmalloc(sizeof(sem_t));
-    conr->client_queue = create_queue(1024);
-    xsem_init(conr->handler_sem, 0);
-    xsem_init(conr->graph_mutex, 1);
-    conr->finished = FALSE;
+    conr->snapshot = NULL;
+    conr->shared = NULL;
+    conr->team = NULL;
+    conr->scheduler = create_scheduler(args.max_thread, args.min_thread);
+    conr->max_fd = sysconf(_SC_OPEN_MAX); // a client fd is always below the limit.
+    conr->accepted_at = xmalloc(sizeof(long) * conr->max_fd);
+    conr->stats = create_stats();
+    conr->numa = (struct NumaTopology *)xmalloc(sizeof(struct NumaTopology));
+    numa_topology(conr->numa);
+    conr->warm = NULL;
+    conr->warm_count = 0;
+    atomic_init(&conr->warm_next, 0);
+    atomic_init(&conr->warm_stop, FALSE);
+    atomic_init(&conr->cache_full, FALSE);
+    conr->warming = FALSE;
+    conr->record_fd = -1;
+    atomic_init(&conr->seen, 0);
+    atomic_init(&conr->recorded, 0);
+    init_rwlock(&conr->graph_lock);
 
-    conr->cache = NULL;
     conr->read_try = xmalloc(sizeof(sem_t));
     conr->read_mutex = xmalloc(sizeof(sem_t));
     conr->write_mutex = xmalloc(sizeof(sem_t));
@@ -500,6 +1706,9 @@ void init_shared_resources()
     dynr->pooler_sem = xmalloc(sizeof(sem_t));
     dynr->load_mutex = xmalloc(sizeof(sem_t));
     dynr->handler_count = 0;
+    dynr->resize = FALSE;
+    dynr->served = dynr->service_us = 0;
+    dynr->load_ewma = dynr->service_ewma = dynr->arrival_ewma = 0;
 
     xsem_init(dynr->pooler_sem, 0);
     xsem_init(dynr->load_mutex, 1);
@@ -509,32 +1718,40 @@ void init_shared_resources()
 
 void destroy_shared_resources()
 {
-    destroy_queue(conr->client_queue);
-    xsem_destroy(conr->graph_mutex);
-    xsem_destroy(conr->handler_sem);
+    destroy_scheduler(conr->scheduler);
+    destroy_rwlock(&conr->graph_lock);
     xsem_destroy(conr->read_try);
     xsem_destroy(conr->read_mutex);
     xsem_destroy(conr->write_mutex);
     xsem_destroy(conr->cache_mutex);
-    free(conr->handler_sem);
-    free(conr->graph_mutex);
-    free(conr->client_queue);
+    free(conr->scheduler);
+    free(conr->accepted_at);
+    free(conr->stats);
+    free(conr->warm);
+    if (conr->record_fd != -1)
+        close(conr->record_fd);
     free(conr->read_try);
     free(conr->read_mutex);
     free(conr->write_mutex);
     free(conr->cache_mutex);
-    if (conr->graph != NULL)
+    if (conr->team != NULL)
     {
-        destroy_graph(conr->graph);
-        free(conr->graph);
-        conr->graph = NULL;
+        destroy_bfs_team(conr->team);
+        free(conr->team);
+        conr->team = NULL;
     }
-    if (conr->cache != NULL)
+    if (conr->snapshot != NULL)
     {
-        destroy_cache(conr->cache);
-        free(conr->cache);
-
-        conr->cache = NULL;
+        destroy_snapshot(conr->snapshot);
+        free(conr->snapshot);
+        conr->snapshot = NULL;
+    }
+    free(conr->numa);
+    if (conr->shared != NULL)
+    {
+        detach_shared_cache(conr->shared);
+        free(conr->shared);
+        conr->shared = NULL;
     }
 
     xsem_destroy(dynr->pooler_sem);
@@ -564,47 +1781,81 @@ int digit(int n)
     return digit_number;
 }
 
-char *prepare_packet(struct Queue *bfs)
+/* grows out to hold need bytes. */
+void reserve_buffer(struct Buffer *out, int need)
 {
-    int max_byte_per_node = digit(conr->graph->V) + 4; // <number> + "->".
+    if (need > out->cap)
+    {
+        out->cap = need > 2 * out->cap ? need : 2 * out->cap;
+        out->data = xrealloc(out->data, out->cap);
+    }
+}
+
+/* formats the path into out, in the ids of the input file, followed by its
+ * cost unless that is negative. */
+char *prepare_packet(struct Queue *bfs, long cost, struct Buffer *out)
+{
+    int max_byte_per_node = digit(conr->snapshot->V) + 4; // <number> + "->".
+    reserve_buffer(out, bfs == NULL ? 19 : max_byte_per_node * size(bfs) + 1 + (cost < 0 ? 0 : 32)); // ", cost <long>."
     if (bfs == NULL)
     {
-        char *packet = xmalloc(19);
-        strcpy(packet, "path not possible.");
-        return packet;
+        strcpy(out->data, "path not possible.");
+        return out->data;
     }
-    char *packet = xmalloc(max_byte_per_node * size(bfs));
 
-    char *temp = xmalloc(max_byte_per_node);
     int offset = 0;
     while (!is_empty(bfs))
     {
         int node = dequeue(bfs);
-        if (!is_empty(bfs))
-            sprintf(temp, "%d->", node);
-        else
-            sprintf(temp, "%d.", node);
-        sprintf(packet + offset, "%s", temp);
-        offset += strlen(temp);
+        if (conr->snapshot->sequence != NULL) // back to the ids of the input file.
+            node = conr->snapshot->sequence[node];
+        offset += sprintf(out->data + offset, !is_empty(bfs) ? "%d->" : cost < 0 ? "%d." : "%d", node);
     }
+    if (cost >= 0)
+        sprintf(out->data + offset, ", cost %ld.", cost);
+    return out->data;
+}
 
-    free(temp);
-    return packet;
+/* one "a->b->c, cost n" line per path, the last one ending with '.'. */
+char *prepare_paths(struct YenPath *paths, int n, struct Buffer *out)
+{
+    if (n == 0)
+        return prepare_packet(NULL, -1, out);
+    int max_byte_per_node = digit(conr->snapshot->V) + 4, need = 1;
+    for (int p = 0; p < n; p++)
+        need += max_byte_per_node * paths[p].n + 32;
+    reserve_buffer(out, need);
+
+    int offset = 0;
+    for (int p = 0; p < n; p++)
+    {
+        for (int v = 0; v < paths[p].n; v++)
+        {
+            int node = paths[p].vertices[v];
+            if (conr->snapshot->sequence != NULL)
+                node = conr->snapshot->sequence[node];
+            offset += sprintf(out->data + offset, v + 1 < paths[p].n ? "%d->" : "%d", node);
+        }
+        offset += sprintf(out->data + offset, p + 1 < n ? ", cost %ld\n" : ", cost %ld.", paths[p].cost);
+    }
+    return out->data;
 }
 
 void create_pool()
 {
-    dynr->pool = xmalloc(sizeof(pthread_t) * dynr->n);
+    // published whole, the terminator joins whatever dynr->pool holds.
+    pthread_t *pool = xmalloc(sizeof(pthread_t) * (max(args.max_thread, args.min_thread) + 1));
     for (int i = 1; i < dynr->n; i++)
     {
         int *nth = xmalloc(sizeof(int));
         *nth = i;
-        xthread_create(&dynr->pool[i], connection_handler, nth);
+        xthread_create(&pool[i], connection_handler, nth);
     }
 
-    xthread_create(&dynr->pool[0], pool_resizer, dynr);
-    dprintf(args.outfd, "[%s] A pool of %d threads have been created\n",
-            timestamp(), dynr->n - 1);
+    xthread_create(&pool[0], pool_resizer, dynr);
+    dynr->pool = pool;
+    xlog(LOG_INFO, "A pool of %d threads have been created\n",
+            dynr->n - 1);
 }
 
 float get_load()
@@ -619,41 +1870,112 @@ float get_load()
 int need_resize(float load)
 {
     if (load == 1)
-        dprintf(args.outfd, "[%s] No thread is available! Waiting for one.\n", timestamp());
+        xlog(LOG_INFO, "No thread is available! Waiting for one.\n");
     return load >= MAX_LOAD;
 }
 
+void grow_pool(struct DynamicPoolerResource *r, int threads, int target)
+{
+    // widen the scheduler first, a new thread above the active range would retire at once.
+    sched_set_active(conr->scheduler, target);
+    for (int i = threads + 1; i <= target; i++)
+    {
+        int *nth = xmalloc(sizeof(int));
+        *nth = i;
+        xthread_create(&r->pool[i], connection_handler, nth);
+    }
+
+    xsem_wait(r->load_mutex);
+    r->n = target + 1;
+    xsem_post(r->load_mutex);
+}
+
+void shrink_pool(struct DynamicPoolerResource *r, int threads, int target)
+{
+    xsem_wait(r->load_mutex);
+    r->n = target + 1;
+    xsem_post(r->load_mutex);
+
+    // retired threads finish their current request and their own queue first.
+    sched_set_active(conr->scheduler, target);
+    for (int i = target + 1; i <= threads; i++)
+        xthread_join(r->pool[i]);
+}
+
+double ewma(double old, double sample)
+{
+    return EWMA_ALPHA * sample + (1 - EWMA_ALPHA) * old;
+}
+
 void *pool_resizer(void *p)
 {
     struct DynamicPoolerResource *r = (struct DynamicPoolerResource *)p;
-    float grow_size = 1.25;
+    int idle_samples = 0, last_queued = 0;
+    long sampled_at = monotonic_us();
 
     while (TRUE)
     {
-        xsem_wait(dynr->pooler_sem);
-
-        // float load = get_load();
-        if (r->n * grow_size <= args.max_thread)
+        // sample periodically, handlers wake us up early when they see MAX_LOAD.
+        xsem_timedwait(r->pooler_sem, SAMPLE_PERIOD_MS);
+
+        xsem_wait(r->load_mutex);
+        int threads = r->n - 1;
+        int busy = r->handler_count;
+        long served = r->served;
+        if (served > 0)
+            r->service_ewma = ewma(r->service_ewma, (double)r->service_us / served);
+        r->served = r->service_us = 0;
+        xsem_post(r->load_mutex);
+
+        int queued = sched_size(conr->scheduler);
+        float load = (busy + queued) / (float)max(threads, 1);
+        r->load_ewma = ewma(r->load_ewma, load);
+
+        // what arrived is what was served plus what the queue grew by.
+        long now = monotonic_us();
+        double period = (now - sampled_at) / 1e6;
+        if (period > 0)
+            r->arrival_ewma = ewma(r->arrival_ewma, max(served + queued - last_queued, 0) / period);
+        sampled_at = now;
+        last_queued = queued;
+        // Little's law: arrivals per second times seconds per request is the threads kept busy.
+        int needed = r->arrival_ewma * r->service_ewma / 1e6 / MAX_LOAD + 1;
+
+        int target = threads;
+        if (load >= MAX_LOAD || needed > threads)
         {
-            xsem_wait(dynr->load_mutex);
-            int old_n = r->n;
-            r->n = (r->n - 1) * grow_size + 1;
-            xsem_post(dynr->load_mutex);
-
-            r->pool = xrealloc(r->pool, sizeof(pthread_t) * r->n);
-            dprintf(args.outfd, "[%s] System load 75%%, pool extended to %d threads.\n", timestamp(), r->n - 1);
-
-            // add threads to pool.
-            for (int i = old_n; i < r->n; i++)
+            // enough threads for the current demand and the smoothed one, at least 25% more.
+            target = max(threads + max(threads / 4, 1), max((busy + queued) / MAX_LOAD + 1, needed));
+            target = target > args.max_thread ? args.max_thread : target;
+            idle_samples = 0;
+        }
+        else if (r->load_ewma < MIN_LOAD && needed < threads)
+        {
+            if (++idle_samples >= IDLE_SAMPLES)
             {
-                int *nth = xmalloc(sizeof(int));
-                *nth = i;
-                xthread_create(&r->pool[i], connection_handler, nth);
+                target = max(max(args.min_thread, needed), threads - max(threads / 4, 1));
+                idle_samples = 0;
             }
         }
-        xsem_wait(dynr->load_mutex);
-        dynr->resize = FALSE;
-        xsem_post(dynr->load_mutex);
+        else
+            idle_samples = 0;
+
+        if (target > threads)
+        {
+            grow_pool(r, threads, target);
+            xlog(LOG_INFO, "System load %.1f%% (%d queued, %.0f arrivals/s, service time %.3f ms), pool extended to %d threads.\n",
+                    100 * load, queued, r->arrival_ewma, r->service_ewma / 1000, target);
+        }
+        else if (target < threads)
+        {
+            shrink_pool(r, threads, target);
+            xlog(LOG_INFO, "System load %.1f%% on average (%.0f arrivals/s, service time %.3f ms), pool shrunk to %d threads.\n",
+                    100 * r->load_ewma, r->arrival_ewma, r->service_ewma / 1000, target);
+        }
+
+        xsem_wait(r->load_mutex);
+        r->resize = FALSE;
+        xsem_post(r->load_mutex);
     }
 
     pthread_exit(NULL);
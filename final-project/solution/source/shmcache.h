@@ -0,0 +1,336 @@
+#ifndef SHMCACHE_H
+#define SHMCACHE_H
+
+#include "utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * shmcache.h
+ * path cache in a POSIX shared memory segment (-M), seen by every worker
+ * process and by the next daemon started on the same port. the layout has
+ * no pointers: a header, the bucket heads of SHARED_STRIPES stripes and one
+ * arena per stripe, entries linked by their offset in the segment. every
+ * stripe has a robust process shared mutex and fills its arena from the
+ * front; a full arena is wiped whole, so is one whose owner died holding
+ * the lock. paths are tagged by the signature of the graph they were found
+ * on, a process whose graph does not match the header bypasses the cache.
+ * @see server.c
+ **/
+
+#define SHARED_MAGIC 0x47504348 // "GPCH"
+#define SHARED_VERSION 2
+#define SHARED_STRIPES 64
+#define SHARED_SLOT 32          // arena allocations are rounded up to this.
+#define SHARED_BUCKET_BYTES 512 // arena bytes per bucket, sizes the tables.
+
+struct SharedEntry
+{
+    long next; // offset of the next entry of the bucket, 0 ends it.
+    int i, j, kind, len;
+    char path[]; // len bytes and a '\0'.
+};
+
+struct SharedStripe
+{
+    pthread_mutex_t lock;
+    long arena, used; // offset of the stripe's arena, bytes taken from it.
+    long entries;
+    long wipes; // times the arena filled up, or was left torn.
+};
+
+struct SharedHeader
+{
+    unsigned int magic, version;
+    long size;
+    long buckets;      // per stripe.
+    long arena_bytes;  // per stripe.
+    atomic_ulong signature; // graph of the cached paths, 0 while it changes.
+    struct SharedStripe stripes[SHARED_STRIPES];
+};
+
+struct SharedCache
+{
+    char *base;
+    struct SharedHeader *header;
+    long *buckets; // SHARED_STRIPES * header->buckets heads.
+};
+
+unsigned long shared_hash(int i, int j)
+{
+    unsigned long h = ((unsigned long)(unsigned int)i << 32) | (unsigned int)j;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdUL;
+    h ^= h >> 33;
+    return h;
+}
+
+/* identifies the graph file by inode, size and modification time, never 0. */
+unsigned long file_signature(int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+        xerror(__func__, "fstat");
+    unsigned long h = shared_hash((int)st.st_ino, (int)st.st_size) ^
+                      shared_hash((int)st.st_mtim.tv_sec, (int)st.st_mtim.tv_nsec) * 31;
+    return h != 0 ? h : 1;
+}
+
+void wipe_stripe(struct SharedCache *cache, int s)
+{
+    struct SharedStripe *stripe = &cache->header->stripes[s];
+    long *heads = cache->buckets + (long)s * cache->header->buckets;
+    for (long b = 0; b < cache->header->buckets; b++)
+        heads[b] = 0;
+    stripe->used = 0;
+    stripe->entries = 0;
+}
+
+void shared_lock(struct SharedCache *cache, int s)
+{
+    int error = pthread_mutex_lock(&cache->header->stripes[s].lock);
+    if (error == EOWNERDEAD) // its process died halfway through, the chains may be torn.
+    {
+        wipe_stripe(cache, s);
+        cache->header->stripes[s].wipes++;
+        pthread_mutex_consistent(&cache->header->stripes[s].lock);
+    }
+    else if (error != 0)
+    {
+        errno = error;
+        xerror(__func__, "pthread_mutex_lock");
+    }
+}
+
+void shared_unlock(struct SharedCache *cache, int s)
+{
+    pthread_mutex_unlock(&cache->header->stripes[s].lock);
+}
+
+/* the bucket heads start right after the header. */
+long shared_header_bytes()
+{
+    return (sizeof(struct SharedHeader) + SHARED_SLOT - 1) / SHARED_SLOT * SHARED_SLOT;
+}
+
+/* lays out an empty cache over the whole segment. */
+void format_shared_cache(struct SharedCache *cache, long size)
+{
+    struct SharedHeader *h = cache->header;
+    long header_bytes = shared_header_bytes();
+    long per_stripe = (size - header_bytes) / SHARED_STRIPES;
+    h->buckets = per_stripe / (SHARED_BUCKET_BYTES + sizeof(long));
+    h->arena_bytes = (per_stripe - h->buckets * sizeof(long)) / SHARED_SLOT * SHARED_SLOT;
+    h->size = size;
+    atomic_init(&h->signature, 0);
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    long arena = header_bytes + SHARED_STRIPES * h->buckets * sizeof(long);
+    for (int s = 0; s < SHARED_STRIPES; s++)
+    {
+        struct SharedStripe *stripe = &h->stripes[s];
+        if ((errno = pthread_mutex_init(&stripe->lock, &attr)) != 0)
+            xerror(__func__, "pthread_mutex_init");
+        stripe->arena = arena + s * h->arena_bytes;
+        wipe_stripe(cache, s);
+        stripe->wipes = 0;
+    }
+    pthread_mutexattr_destroy(&attr);
+    h->version = SHARED_VERSION;
+    h->magic = SHARED_MAGIC;
+}
+
+/* maps the segment called name, size bytes, keeping the paths a previous
+ * daemon left there if its layout matches. */
+struct SharedCache *attach_shared_cache(const char *name, long size)
+{
+    int fd = shm_open(name, O_CREAT | O_RDWR, 0600);
+    if (fd == -1)
+        xerror(__func__, "shm_open");
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+        xerror(__func__, "fstat");
+    if (st.st_size != size && ftruncate(fd, size) == -1)
+        xerror(__func__, "ftruncate");
+
+    struct SharedCache *cache = (struct SharedCache *)xmalloc(sizeof(struct SharedCache));
+    cache->base = (char *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (cache->base == MAP_FAILED)
+        xerror(__func__, "mmap");
+    xclose(fd);
+    cache->header = (struct SharedHeader *)cache->base;
+
+    struct SharedHeader *h = cache->header;
+    cache->buckets = (long *)(cache->base + shared_header_bytes());
+    if (st.st_size != size || h->magic != SHARED_MAGIC || h->version != SHARED_VERSION || h->size != size)
+        format_shared_cache(cache, size);
+    return cache;
+}
+
+long shared_entries(struct SharedCache *cache)
+{
+    long n = 0;
+    for (int s = 0; s < SHARED_STRIPES; s++)
+        n += cache->header->stripes[s].entries;
+    return n;
+}
+
+long shared_wipes(struct SharedCache *cache)
+{
+    long n = 0;
+    for (int s = 0; s < SHARED_STRIPES; s++)
+        n += cache->header->stripes[s].wipes;
+    return n;
+}
+
+/* makes the cache hold paths of the graph with this signature: kept if
+ * they already are (a warm restart), dropped otherwise. returns TRUE if kept. */
+int adopt_shared_cache(struct SharedCache *cache, unsigned long signature)
+{
+    if (atomic_load(&cache->header->signature) == signature)
+        return TRUE;
+    atomic_store(&cache->header->signature, 0); // nobody inserts while the stripes are wiped.
+    for (int s = 0; s < SHARED_STRIPES; s++)
+    {
+        shared_lock(cache, s);
+        wipe_stripe(cache, s);
+        shared_unlock(cache, s);
+    }
+    atomic_store(&cache->header->signature, signature);
+    return FALSE;
+}
+
+/* the cached graph was changed in place: its paths stay, a later start on
+ * the input file must not adopt them. returns the graph's new signature. */
+unsigned long retag_shared_cache(struct SharedCache *cache, unsigned long signature)
+{
+    signature = signature * 0x9e3779b97f4a7c15UL + 1;
+    if (signature == 0)
+        signature = 1;
+    atomic_store(&cache->header->signature, signature);
+    return signature;
+}
+
+struct SharedEntry *shared_entry(struct SharedCache *cache, long offset)
+{
+    return (struct SharedEntry *)(cache->base + offset);
+}
+
+/* looks in the stripe of (i, j, kind), the caller holds its lock. */
+struct SharedEntry *shared_find(struct SharedCache *cache, long *head, int i, int j, int kind)
+{
+    for (long at = *head; at != 0;)
+    {
+        struct SharedEntry *e = shared_entry(cache, at);
+        if (e->i == i && e->j == j && e->kind == kind)
+            return e;
+        at = e->next;
+    }
+    return NULL;
+}
+
+long *shared_bucket(struct SharedCache *cache, int i, int j, int kind, int *s)
+{
+    unsigned long h = shared_hash(i, j) + kind * 0x9e3779b97f4a7c15UL;
+    *s = h % SHARED_STRIPES;
+    return cache->buckets + (long)*s * cache->header->buckets + (long)(h / SHARED_STRIPES % cache->header->buckets);
+}
+
+/* copy of the cached path, NULL if there is none for the graph with signature. */
+char *get_shared_cache(struct SharedCache *cache, unsigned long signature, int i, int j, int kind)
+{
+    int s;
+    long *head = shared_bucket(cache, i, j, kind, &s);
+    char *path = NULL;
+    shared_lock(cache, s);
+    struct SharedEntry *e;
+    if (atomic_load(&cache->header->signature) == signature && (e = shared_find(cache, head, i, j, kind)) != NULL)
+    {
+        path = (char *)xmalloc(e->len + 1);
+        memcpy(path, e->path, e->len + 1);
+    }
+    shared_unlock(cache, s);
+    return path;
+}
+
+/* copies path in, the caller keeps it. returns how many paths were dropped
+ * to make room. */
+long to_shared_cache(struct SharedCache *cache, unsigned long signature, int i, int j, int kind,
+                     const char *path)
+{
+    int s;
+    long evicted = 0;
+    long *head = shared_bucket(cache, i, j, kind, &s);
+    int len = strlen(path);
+    long need = (sizeof(struct SharedEntry) + len + 1 + SHARED_SLOT - 1) / SHARED_SLOT * SHARED_SLOT;
+    struct SharedStripe *stripe = &cache->header->stripes[s];
+    if (need > cache->header->arena_bytes)
+        return 0;
+
+    shared_lock(cache, s);
+    // another process may have cached it meanwhile, or be serving an older graph.
+    if (atomic_load(&cache->header->signature) == signature && shared_find(cache, head, i, j, kind) == NULL)
+    {
+        if (stripe->used + need > cache->header->arena_bytes)
+        {
+            evicted = stripe->entries;
+            wipe_stripe(cache, s);
+            stripe->wipes++;
+        }
+        long at = stripe->arena + stripe->used;
+        struct SharedEntry *e = shared_entry(cache, at);
+        e->i = i;
+        e->j = j;
+        e->kind = kind;
+        e->len = len;
+        memcpy(e->path, path, len + 1);
+        e->next = *head;
+        *head = at;
+        stripe->used += need;
+        stripe->entries++;
+    }
+    shared_unlock(cache, s);
+    return evicted;
+}
+
+/* evict_cache_if() of cache.h, the space comes back with the next wipe. */
+int evict_shared_cache_if(struct SharedCache *cache, int (*stale)(int i, int j, int kind, char *path, void *arg),
+                          void *arg)
+{
+    int evicted = 0;
+    for (int s = 0; s < SHARED_STRIPES; s++)
+    {
+        shared_lock(cache, s);
+        long *heads = cache->buckets + (long)s * cache->header->buckets;
+        for (long b = 0; b < cache->header->buckets; b++)
+            for (long *link = &heads[b]; *link != 0;)
+            {
+                struct SharedEntry *e = shared_entry(cache, *link);
+                if (!stale(e->i, e->j, e->kind, e->path, arg))
+                {
+                    link = &e->next;
+                    continue;
+                }
+                *link = e->next;
+                cache->header->stripes[s].entries--;
+                evicted++;
+            }
+        shared_unlock(cache, s);
+    }
+    return evicted;
+}
+
+/* unmaps, the segment stays for the next start. */
+void detach_shared_cache(struct SharedCache *cache)
+{
+    munmap(cache->base, cache->header->size);
+}
+
+#endif
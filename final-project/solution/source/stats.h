@@ -0,0 +1,150 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "utils.h"
+#include <stdatomic.h>
+#include <stdio.h>
+
+/**
+ * stats.h
+ * request counters and HDR style latency histograms of the server. values
+ * are bucketed by their power of two and HIST_SUB linear steps inside it,
+ * so any percentile is off by at most 1/HIST_SUB of its value while a
+ * histogram stays a fixed array of counters that threads bump without locks.
+ * @see server.c
+ **/
+
+#define HIST_SUB_BITS 4
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS (48 * HIST_SUB) // covers values up to 2^51.
+
+struct Histogram
+{
+    atomic_long count[HIST_BUCKETS];
+    atomic_long total, sum, max;
+};
+
+struct Stats
+{
+    struct Histogram queue_wait;   // accepted -> taken by a handler.
+    struct Histogram cache_lookup; // read_database().
+    struct Histogram bfs;          // path calculation, misses only.
+    struct Histogram send;         // writing the response.
+    atomic_long requests, hits, misses, evictions;
+    atomic_long unreachable; // answered by the component index.
+    atomic_long updates, invalidated; // edge batches applied, cached paths they dropped.
+    atomic_long reloads;              // graphs swapped in on SIGHUP.
+    atomic_long refused, expired;     // turned away busy: queue full (-Q), waited too long (-T).
+    atomic_long timeouts;             // searches given up at the packet's timeout or a hang up.
+    atomic_long warmed;               // paths of the -W file computed into the cache.
+};
+
+int hist_bucket(long v)
+{
+    if (v < HIST_SUB)
+        return v < 0 ? 0 : (int)v;
+    int shift = 63 - __builtin_clzl(v) - HIST_SUB_BITS;
+    int bucket = (shift + 1) * HIST_SUB + (int)((v >> shift) - HIST_SUB);
+    return bucket < HIST_BUCKETS ? bucket : HIST_BUCKETS - 1;
+}
+
+/* smallest value that falls into the bucket. */
+long hist_value(int bucket)
+{
+    if (bucket < HIST_SUB)
+        return bucket;
+    int shift = bucket / HIST_SUB - 1;
+    return (long)(HIST_SUB + bucket % HIST_SUB) << shift;
+}
+
+void hist_record(struct Histogram *h, long v)
+{
+    atomic_fetch_add_explicit(&h->count[hist_bucket(v)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->total, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->sum, v, memory_order_relaxed);
+
+    long max = atomic_load_explicit(&h->max, memory_order_relaxed);
+    while (v > max && !atomic_compare_exchange_weak_explicit(&h->max, &max, v,
+                                                             memory_order_relaxed, memory_order_relaxed))
+        ;
+}
+
+/* value below which p percent of the recorded values are. */
+long hist_percentile(struct Histogram *h, double p)
+{
+    long total = atomic_load_explicit(&h->total, memory_order_relaxed);
+    long rank = (long)(total * p / 100), seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += atomic_load_explicit(&h->count[i], memory_order_relaxed);
+        if (seen > rank)
+            return hist_value(i);
+    }
+    return atomic_load_explicit(&h->max, memory_order_relaxed);
+}
+
+void init_histogram(struct Histogram *h)
+{
+    for (int i = 0; i < HIST_BUCKETS; i++)
+        atomic_init(&h->count[i], 0);
+    atomic_init(&h->total, 0);
+    atomic_init(&h->sum, 0);
+    atomic_init(&h->max, 0);
+}
+
+struct Stats *create_stats()
+{
+    struct Stats *s = (struct Stats *)xmalloc(sizeof(struct Stats));
+    init_histogram(&s->queue_wait);
+    init_histogram(&s->cache_lookup);
+    init_histogram(&s->bfs);
+    init_histogram(&s->send);
+    atomic_init(&s->requests, 0);
+    atomic_init(&s->hits, 0);
+    atomic_init(&s->misses, 0);
+    atomic_init(&s->evictions, 0);
+    atomic_init(&s->unreachable, 0);
+    atomic_init(&s->updates, 0);
+    atomic_init(&s->invalidated, 0);
+    atomic_init(&s->reloads, 0);
+    atomic_init(&s->refused, 0);
+    atomic_init(&s->expired, 0);
+    atomic_init(&s->timeouts, 0);
+    atomic_init(&s->warmed, 0);
+    return s;
+}
+
+void stats_count(atomic_long *counter)
+{
+    atomic_fetch_add_explicit(counter, 1, memory_order_relaxed);
+}
+
+/* one line per histogram, returns the number of bytes written like snprintf. */
+int hist_format(struct Histogram *h, const char *name, char *buf, int size)
+{
+    long total = atomic_load_explicit(&h->total, memory_order_relaxed);
+    long sum = atomic_load_explicit(&h->sum, memory_order_relaxed);
+    return snprintf(buf, size, "%s_us count %ld mean %ld p50 %ld p90 %ld p99 %ld p999 %ld max %ld\n",
+                    name, total, total ? sum / total : 0, hist_percentile(h, 50), hist_percentile(h, 90),
+                    hist_percentile(h, 99), hist_percentile(h, 99.9),
+                    atomic_load_explicit(&h->max, memory_order_relaxed));
+}
+
+/* dumps counters and histograms as "name value" lines. */
+int stats_format(struct Stats *s, char *buf, int size)
+{
+    int len = snprintf(buf, size, "requests %ld\nhits %ld\nmisses %ld\nevictions %ld\nunreachable %ld\n"
+                       "updates %ld\ninvalidated %ld\nreloads %ld\nrefused %ld\nexpired %ld\ntimeouts %ld\nwarmed %ld\n",
+                       atomic_load(&s->requests), atomic_load(&s->hits), atomic_load(&s->misses),
+                       atomic_load(&s->evictions), atomic_load(&s->unreachable),
+                       atomic_load(&s->updates), atomic_load(&s->invalidated), atomic_load(&s->reloads),
+                       atomic_load(&s->refused), atomic_load(&s->expired),
+                       atomic_load(&s->timeouts), atomic_load(&s->warmed));
+    len += hist_format(&s->queue_wait, "queue_wait", buf + len, size - len);
+    len += hist_format(&s->cache_lookup, "cache_lookup", buf + len, size - len);
+    len += hist_format(&s->bfs, "bfs", buf + len, size - len);
+    len += hist_format(&s->send, "send", buf + len, size - len);
+    return len;
+}
+
+#endif
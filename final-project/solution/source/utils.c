@@ -9,8 +9,28 @@
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <time.h>
 #include "utils.h"
 #include <getopt.h>
+#include <sys/socket.h>
+
+int parse_order(const char *name)
+{
+    const char *names[] = {"none", "bfs", "rcm", "degree"};
+    for (int i = 0; i < 4; i++)
+        if (strcmp(name, names[i]) == 0)
+            return i;
+    return -1;
+}
+
+int parse_numa(const char *name)
+{
+    const char *names[] = {"none", "interleave", "replicate"};
+    for (int i = 0; i < 3; i++)
+        if (strcmp(name, names[i]) == 0)
+            return i;
+    return -1;
+}
 
 void check_arg(int flag, char arg);
 int str_to_int(char *buf);
@@ -19,18 +39,35 @@ int str_to_int(char *buf);
 void parse_args(int argc, char **argv, struct Args *args)
 {
     int iflag = FALSE, pflag = FALSE, oflag = FALSE, xflag = FALSE, sflag = FALSE;
+    args->log_level = 2; // everything, optional flags keep their defaults when missing.
+    args->landmarks = 0;
+    args->order = ORDER_NONE;
+    args->compressed = FALSE;
+    args->helpers = 0;
+    args->workers = 0;
+    args->shared_cache = 0;
+    args->cache_limit = 256;
+    args->queue_limit = 0;
+    args->deadline_ms = 0;
+    args->backlog = SOMAXCONN;
+    args->warm = NULL;
+    args->record = 0;
+    args->numa = NUMA_NONE;
+    args->pin = FALSE;
 
     char opt;
-    while ((opt = getopt(argc, argv, "i:o:p:s:x:")) != -1)
+    while ((opt = getopt(argc, argv, "i:o:p:s:x:l:L:O:CP:w:M:K:Q:T:B:W:R:N:A")) != -1)
     {
         switch (opt)
         {
         case 'i':
             args->infd = xopen(optarg, O_RDONLY);
+            args->input = optarg;
             iflag = TRUE;
             break;
         case 'o':
             args->outfd = xopen(optarg, O_CREAT | O_WRONLY | O_EXCL); 
+            args->output = optarg;
             oflag = TRUE;
             break;
         case 'p':
@@ -60,6 +97,109 @@ void parse_args(int argc, char **argv, struct Args *args)
                 exit(EXIT_FAILURE);
             }
             break;
+        case 'l':
+            args->log_level = str_to_int(optarg);
+            if (args->log_level < 0 || args->log_level > 2)
+            {
+                fprintf(stderr, "Log level (l) arg, is not in range [0, 2].");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'L':
+            args->landmarks = str_to_int(optarg);
+            if (args->landmarks < 0)
+            {
+                fprintf(stderr, "Number of landmarks (L) arg, is not in range [0, +inf].");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'O':
+            if ((args->order = parse_order(optarg)) == -1)
+            {
+                fprintf(stderr, "Vertex order (O) arg, is not one of none, bfs, rcm, degree.");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'C':
+            args->compressed = TRUE;
+            break;
+        case 'P':
+            args->helpers = str_to_int(optarg);
+            if (args->helpers < 0)
+            {
+                fprintf(stderr, "Number of BFS helper threads (P) arg, is not in range [0, +inf].");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'w':
+            args->workers = str_to_int(optarg);
+            if (args->workers < 0)
+            {
+                fprintf(stderr, "Number of worker processes (w) arg, is not in range [0, +inf].");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'M':
+            args->shared_cache = str_to_int(optarg);
+            if (args->shared_cache < 0)
+            {
+                fprintf(stderr, "Shared cache megabytes (M) arg, is not in range [0, +inf].");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'K':
+            args->cache_limit = str_to_int(optarg);
+            if (args->cache_limit < 0)
+            {
+                fprintf(stderr, "Cache limit megabytes (K) arg, is not in range [0, +inf].");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'Q':
+            args->queue_limit = str_to_int(optarg);
+            if (args->queue_limit < 0)
+            {
+                fprintf(stderr, "Queued connections (Q) arg, is not in range [0, +inf].");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'T':
+            args->deadline_ms = str_to_int(optarg);
+            if (args->deadline_ms < 0)
+            {
+                fprintf(stderr, "Queue deadline milliseconds (T) arg, is not in range [0, +inf].");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'B':
+            args->backlog = str_to_int(optarg);
+            if (args->backlog < 1)
+            {
+                fprintf(stderr, "Listen backlog (B) arg, is not in range [1, +inf].");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'W':
+            args->warm = optarg;
+            break;
+        case 'N':
+            if ((args->numa = parse_numa(optarg)) == -1)
+            {
+                fprintf(stderr, "NUMA placement (N) arg, is not one of none, interleave, replicate.");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'A':
+            args->pin = TRUE;
+            break;
+        case 'R':
+            args->record = str_to_int(optarg);
+            if (args->record < 0)
+            {
+                fprintf(stderr, "Recorded query ratio (R) arg, is not in range [0, +inf].");
+                exit(EXIT_FAILURE);
+            }
+            break;
         case '?':
         default:
             help();
@@ -72,11 +212,10 @@ void parse_args(int argc, char **argv, struct Args *args)
     check_arg(oflag, 'o');
     check_arg(sflag, 's');
     check_arg(xflag, 'x');
-    dprintf(args->outfd, "[%s] Executing with parameters: \n", timestamp());
-    dprintf(args->outfd, "-i %s\n-p %s\n-o %s\n-s %s\n-x %s\n", 
-    argv[2], argv[4], argv[6], argv[8], argv[10]);
     if (args->max_thread < args->min_thread)
         xerror(__func__, "error: max thread count < min thread count");
+    if (args->record > 0)
+        check_arg(args->warm != NULL, 'W');
 }
 
 void check_arg(int flag, char arg)
@@ -92,12 +231,46 @@ void check_arg(int flag, char arg)
 /* prints usage */
 void help()
 {
-    printf("Usage: ./program -i [filePath]\n"
-           "Example: $./program -i filePath\n"
+    printf("Usage: ./server -i <graph_file> -p <port> -o <log_file> -s <min_threads> -x <max_threads> [-l <level>] [-L <landmarks>] [-O <order>] [-C] [-P <helpers>] [-w <workers>] [-M <megabytes>] [-K <megabytes>] [-Q <queued>] [-T <ms>] [-B <backlog>]\n"
+           "               [-W <warm_file>] [-R <ratio>] [-N <placement>] [-A]\n"
+           "Example: $./server -i graph.txt -p 34567 -o log.txt -s 4 -x 24\n"
            "Further information.\n"
-           "[filepath] is an absolute/relative file path.\n\n"
-           "\t-i:\t\tfile containing data\n"
+           "[graph_file] and [log_file] are absolute/relative file paths.\n\n"
+           "\t-i:\t\tfile containing the graph, \"i<TAB>j\" or \"i<TAB>j<TAB>weight\" per line;\n"
+           "\t\t\tedges added by clients weigh 1\n"
+           "\t-p:\t\tport to listen on\n"
+           "\t-o:\t\tlog file\n"
+           "\t-s:\t\tnumber of threads in the pool at startup\n"
+           "\t-x:\t\tmaximum number of threads in the pool\n"
+           "\t-l:\t\tlog level, 0: errors, 1: results, 2: everything (default)\n"
+           "\t-L:\t\tlandmarks to label every node with, 4 bytes per node each, 0 (default) disables them\n"
+           "\t-O:\t\tvertex order for locality: none (default), bfs, rcm, degree\n"
+           "\t-C:\t\tkeep the adjacency lists delta + varint compressed, best with -O\n"
+           "\t-P:\t\tthreads helping to expand wide BFS levels, 0 (default) disables them\n"
+           "\t-w:\t\tworker processes sharing the port and the loaded graph, each with its own\n"
+           "\t\t\tpool, crashed ones are restarted; 0 (default) serves from a single process\n"
+           "\t-M:\t\tkeep the path cache in a shared memory segment of this size, seen by all\n"
+           "\t\t\tworkers and kept for the next start on the same port and graph file;\n"
+           "\t\t\t0 (default) keeps it in the daemon's heap\n"
+           "\t-K:\t\tmegabytes the path cache may take in the daemon's heap, once full it is\n"
+           "\t\t\tcleared and its memory handed back; 256 by default, 0 lets it grow\n"
+           "\t-Q:\t\tconnections waiting for a thread before new ones are answered \"" BUSY_REPLY "\",\n"
+           "\t\t\t0 (default) stops accepting until there is room\n"
+           "\t-T:\t\tmilliseconds a connection may wait for a thread before it is answered\n"
+           "\t\t\t\"" BUSY_REPLY "\" instead of served, 0 (default) waits as long as it takes\n"
+           "\t-B:\t\tlisten backlog, SOMAXCONN by default\n"
+           "\t-W:\t\t\"src<TAB>dst\" lines whose paths are computed into the cache at start, most\n"
+           "\t\t\trecent (last) first, by idle priority threads that pause while clients wait\n"
+           "\t-R:\t\tappend 1 of every this many path queries to the -W file, which then keeps\n"
+           "\t\t\tthe most recent pairs only; 0 (default) records none\n"
+           "\t-N:\t\tgraph placement over NUMA nodes: none (default), interleave the pages over\n"
+           "\t\t\tall nodes, or replicate the adjacency lists on each node, a search then reads\n"
+           "\t\t\tthe copy of the node it runs on\n"
+           "\t-A:\t\tpin the pool threads to the cpus of one node each, in turn\n"
            "\t--help:\t\tdisplay what you are reading now\n\n"
+           "Sending SIGHUP reloads [graph_file] while the old graph keeps serving,\n"
+           "edges added or removed since the last load are lost. with -w the workers\n"
+           "are restarted one at a time on the new graph.\n\n"
            "Exis status:\n"
            "0\tif OK,\n"
            "1\tif minor problems (e.g., cannot find the file.), \n"
@@ -246,6 +419,131 @@ void xsem_post(sem_t *sem)
         xerror(__func__, "sem_post");
 }
 
+int xsem_trywait(sem_t *sem)
+{
+    while (sem_trywait(sem) == -1)
+    {
+        if (errno == EAGAIN)
+            return FALSE;
+        if (errno != EINTR)
+            xerror(__func__, "sem_trywait");
+    }
+    return TRUE;
+}
+
+void init_rwlock(struct RWLock *lock)
+{
+    xsem_init(&lock->read_try, 1);
+    xsem_init(&lock->read_mutex, 1);
+    xsem_init(&lock->write_mutex, 1);
+    xsem_init(&lock->resource, 1);
+    lock->read_count = lock->write_count = 0;
+}
+
+void read_lock(struct RWLock *lock)
+{
+    xsem_wait(&lock->read_try);
+    xsem_wait(&lock->read_mutex);
+    if (++lock->read_count == 1)
+        xsem_wait(&lock->resource);
+    xsem_post(&lock->read_mutex);
+    xsem_post(&lock->read_try);
+}
+
+void read_unlock(struct RWLock *lock)
+{
+    xsem_wait(&lock->read_mutex);
+    if (--lock->read_count == 0)
+        xsem_post(&lock->resource);
+    xsem_post(&lock->read_mutex);
+}
+
+void write_lock(struct RWLock *lock)
+{
+    xsem_wait(&lock->write_mutex);
+    if (++lock->write_count == 1)
+        xsem_wait(&lock->read_try);
+    xsem_post(&lock->write_mutex);
+    xsem_wait(&lock->resource);
+}
+
+void write_unlock(struct RWLock *lock)
+{
+    xsem_post(&lock->resource);
+    xsem_wait(&lock->write_mutex);
+    if (--lock->write_count == 0)
+        xsem_post(&lock->read_try);
+    xsem_post(&lock->write_mutex);
+}
+
+void destroy_rwlock(struct RWLock *lock)
+{
+    xsem_destroy(&lock->read_try);
+    xsem_destroy(&lock->read_mutex);
+    xsem_destroy(&lock->write_mutex);
+    xsem_destroy(&lock->resource);
+}
+
+int xread_full(int fd, void *buf, size_t size)
+{
+    size_t done = 0;
+    while (done < size)
+    {
+        int n = read(fd, (char *)buf + done, size - done);
+        if (n == 0 || (n == -1 && errno == ECONNRESET))
+            return FALSE;
+        if (n == -1)
+            xerror(__func__, "read");
+        done += n;
+    }
+    return TRUE;
+}
+
+int send_full(int fd, const void *buf, size_t size)
+{
+    size_t done = 0;
+    while (done < size)
+    {
+        int n = send(fd, (const char *)buf + done, size - done, MSG_NOSIGNAL);
+        if (n == -1 && (errno == EPIPE || errno == ECONNRESET))
+            return FALSE;
+        if (n == -1)
+            xerror(__func__, "send");
+        done += n;
+    }
+    return TRUE;
+}
+
+int peer_closed(int fd)
+{
+    char c;
+    int n = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n == 0 || (n == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
+}
+
+int xsem_timedwait(sem_t *sem, long ms)
+{
+    struct timespec ts;
+    if (clock_gettime(CLOCK_REALTIME, &ts) == -1)
+        xerror(__func__, "clock_gettime");
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (ms % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000)
+    {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+
+    while (sem_timedwait(sem, &ts) == -1)
+    {
+        if (errno == ETIMEDOUT)
+            return FALSE;
+        if (errno != EINTR)
+            xerror(__func__, "sem_timedwait");
+    }
+    return TRUE;
+}
+
 void xsem_init(sem_t *sem, int value)
 {
     if (sem_init(sem, FALSE, (unsigned int)value) == -1)
@@ -268,3 +566,10 @@ char *timestamp()
     new_line[0] = '\0';
     return time_str;
 }
+
+long monotonic_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
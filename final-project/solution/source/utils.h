@@ -18,12 +18,68 @@ struct Args
 {
     int infd, outfd, port;
     int min_thread, max_thread;
+    int log_level;
+    int landmarks; // size of the landmark index, 0 disables it.
+    int order;     // vertex relabeling done at load, one of ORDER_*.
+    int compressed; // serve from varint encoded adjacency lists.
+    int helpers;    // threads helping a single BFS, 0 disables it.
+    int workers;    // processes sharing the port, 0 serves from the daemon itself.
+    int shared_cache; // megabytes of shared memory path cache, 0 keeps it private.
+    int cache_limit;  // megabytes the private path cache may take before it is cleared, 0 for no limit.
+    int queue_limit;  // queued connections before new ones are refused, 0 waits for room.
+    int deadline_ms;  // queue wait after which a connection is refused, 0 never.
+    int backlog;      // of listen().
+    int record;       // 1 of every this many path queries is appended to the warm file, 0 records none.
+    int numa;         // placement of the graph over NUMA nodes, one of NUMA_*.
+    int pin;          // keep every handler thread on the cpus of one node.
+    char *input, *output; // paths given with -i and -o.
+    char *warm;           // (src, dst) pairs to fill the cache with at start, -W, NULL for none.
 };
 
-/* Client will send two non-negative integers */
+/* vertex orders (-O) */
+#define ORDER_NONE 0
+#define ORDER_BFS 1
+#define ORDER_RCM 2
+#define ORDER_DEGREE 3
+
+/* graph placements (-N) */
+#define NUMA_NONE 0       // pages wherever the loading thread touches them first.
+#define NUMA_INTERLEAVE 1 // pages spread round robin over the nodes.
+#define NUMA_REPLICATE 2  // a copy of the adjacency on every node.
+
+/* query types */
+#define QUERY_PATH 0   // path from i1 to i2.
+#define QUERY_STATS 1  // counters and latency histograms of the server.
+#define QUERY_ADD 2    // add i1 edges, sent as struct Edge right after the packet.
+#define QUERY_REMOVE 3 // remove i1 edges, same layout.
+#define QUERY_WEIGHTED 4 // path from i1 to i2 of least total weight, and the weight.
+#define QUERY_KPATHS 5   // up to k loopless paths from i1 to i2, k sent as an unsigned int after the packet.
+#define QUERY_REACH 6    // whether i2 is reachable from i1, no path.
+#define QUERY_DISTANCE 7 // hops from i1 to i2, -1 if unreachable, no path.
+
+#define UPDATE_MAX_EDGES 65536 // edges in one add/remove batch.
+#define BUSY_REPLY "busy, retry later." // the server is saturated, the query was not read.
+#define TIMEOUT_REPLY "search timed out." // the search outlived timeout_ms of the packet.
+
+/* Client will send the query type and two non-negative integers */
 struct Packet
 {
+    unsigned int type;
     unsigned int i1, i2;
+    unsigned int timeout_ms; // since the server accepted the connection, 0 waits as long as it takes.
+};
+
+/* one edge of an update batch */
+struct Edge
+{
+    unsigned int from, to;
+};
+
+/* readers-writer lock out of semaphores, writers go first */
+struct RWLock
+{
+    sem_t read_try, read_mutex, write_mutex, resource;
+    int read_count, write_count;
 };
 
 
@@ -66,12 +122,40 @@ void xthread_join(pthread_t thread);
 /* strtol with error checking */
 int str_to_int(char *buf);
 
+/* ORDER_* of an order name, -1 if there is no such order */
+int parse_order(const char *name);
+
+/* NUMA_* of a placement name, -1 if there is no such placement */
+int parse_numa(const char *name);
+
 /* sem_wait with error checking */
 void xsem_wait(sem_t *sem);
 
 /* sem_post with error checking */
 void xsem_post(sem_t *sem);
 
+/* sem_timedwait with error checking, returns FALSE on timeout */
+int xsem_timedwait(sem_t *sem, long ms);
+
+/* sem_trywait with error checking, returns FALSE if it would block */
+int xsem_trywait(sem_t *sem);
+
+void init_rwlock(struct RWLock *lock);
+void read_lock(struct RWLock *lock);
+void read_unlock(struct RWLock *lock);
+void write_lock(struct RWLock *lock);
+void write_unlock(struct RWLock *lock);
+void destroy_rwlock(struct RWLock *lock);
+
+/* reads exactly size bytes, FALSE if the peer closed or reset first */
+int xread_full(int fd, void *buf, size_t size);
+
+/* writes all of buf to a socket without raising SIGPIPE, FALSE if the peer is gone */
+int send_full(int fd, const void *buf, size_t size);
+
+/* TRUE if the peer of a socket hung up, without consuming what it sent */
+int peer_closed(int fd);
+
 /* sem_init with error checking */
 void xsem_init(sem_t *sem, int value);
 
@@ -80,4 +164,7 @@ void xsem_destroy(sem_t *sem);
 
 char *timestamp();
 
+/* monotonic clock in microseconds */
+long monotonic_us();
+
 #endif //UNTITLED1_UTILS_H
@@ -0,0 +1,152 @@
+#ifndef YEN_H
+#define YEN_H
+
+#include "utils.h"
+#include "graph.h"
+#include "dijkstra.h"
+#include <string.h>
+
+/**
+ * yen.h
+ * up to k loopless paths from start to end in increasing cost (Yen). the
+ * i-th path is the cheapest one leaving every earlier path somewhere: for
+ * each vertex of the previous path, the root up to it is kept and a spur
+ * path is searched from it with the root's other vertices banned and the
+ * edges the earlier paths with the same root take next removed. the spur
+ * paths go to a candidate list, the cheapest candidate becomes the next
+ * path. costs are those of dijkstra.h, hops on a graph without weights.
+ * @see server.c
+ **/
+
+#define YEN_MAX_K 16 // paths in one answer.
+
+struct YenPath
+{
+    int *vertices;
+    int n;
+    long cost;
+};
+
+/* cheapest weight of an edge u->v, parallel edges may differ. */
+long edge_weight(struct Graph *graph, int u, int v)
+{
+    long best = -1;
+    for (struct AdjacencyNode *adj = graph->list[u]; adj != NULL; adj = adj->next)
+        if (adj->vertex == v && (best == -1 || adj->weight < best))
+            best = adj->weight;
+    return best;
+}
+
+struct YenPath yen_from_queue(struct Queue *path, long cost)
+{
+    struct YenPath p = {(int *)xmalloc(sizeof(int) * size(path)), 0, cost};
+    while (!is_empty(path))
+        p.vertices[p.n++] = dequeue(path);
+    destroy_queue(path);
+    free(path);
+    return p;
+}
+
+int yen_same(struct YenPath *a, struct YenPath *b)
+{
+    return a->n == b->n && memcmp(a->vertices, b->vertices, sizeof(int) * a->n) == 0;
+}
+
+/* TRUE if p starts with the first n vertices of root. */
+int yen_shares_root(struct YenPath *p, struct YenPath *root, int n)
+{
+    return p->n > n && memcmp(p->vertices, root->vertices, sizeof(int) * n) == 0;
+}
+
+/* fills paths[0..k) with the cheapest loopless paths, returns how many there are. */
+int yen_paths(struct Graph *graph, int start, int end, int k, struct YenPath *paths, struct SearchStats *stats)
+{
+    long cost;
+    struct Queue *first = dijkstra(graph, start, end, &cost, stats);
+    if (first == NULL || k < 1)
+    {
+        if (first != NULL)
+        {
+            destroy_queue(first);
+            free(first);
+        }
+        return 0;
+    }
+    paths[0] = yen_from_queue(first, cost);
+
+    int found = 1, candidates = 0, cap = k;
+    struct YenPath *candidate = (struct YenPath *)xmalloc(sizeof(struct YenPath) * cap);
+    char *banned = (char *)xmalloc(graph->V);
+    memset(banned, 0, graph->V);
+    while (found < k && !search_cancelled(stats))
+    {
+        struct YenPath *prev = &paths[found - 1];
+        long root_cost = 0;
+        for (int i = 0; i + 1 < prev->n && !search_cancelled(stats); i++)
+        {
+            int spur = prev->vertices[i];
+            for (int r = 0; r < i; r++)
+                banned[prev->vertices[r]] |= BAN_VERTEX;
+            for (int p = 0; p < found; p++)
+                if (yen_shares_root(&paths[p], prev, i + 1))
+                    banned[paths[p].vertices[i + 1]] |= BAN_FROM_START;
+
+            struct Queue *spur_path = dijkstra_avoiding(graph, spur, end, banned, &cost, stats);
+            for (int r = 0; r < i; r++)
+                banned[prev->vertices[r]] = 0;
+            for (int p = 0; p < found; p++)
+                if (yen_shares_root(&paths[p], prev, i + 1))
+                    banned[paths[p].vertices[i + 1]] = 0;
+
+            if (spur_path != NULL)
+            {
+                struct YenPath c = {(int *)xmalloc(sizeof(int) * (i + size(spur_path))), i, root_cost + cost};
+                memcpy(c.vertices, prev->vertices, sizeof(int) * i);
+                while (!is_empty(spur_path))
+                    c.vertices[c.n++] = dequeue(spur_path);
+                destroy_queue(spur_path);
+                free(spur_path);
+
+                int duplicate = FALSE;
+                for (int d = 0; d < candidates && !duplicate; d++)
+                    duplicate = yen_same(&candidate[d], &c);
+                if (duplicate)
+                    free(c.vertices);
+                else
+                {
+                    if (candidates == cap)
+                    {
+                        cap *= 2;
+                        candidate = (struct YenPath *)xrealloc(candidate, sizeof(struct YenPath) * cap);
+                    }
+                    candidate[candidates++] = c;
+                }
+            }
+            root_cost += edge_weight(graph, spur, prev->vertices[i + 1]);
+        }
+        if (candidates == 0)
+            break;
+
+        int best = 0;
+        for (int d = 1; d < candidates; d++)
+            if (candidate[d].cost < candidate[best].cost ||
+                (candidate[d].cost == candidate[best].cost && candidate[d].n < candidate[best].n))
+                best = d;
+        paths[found++] = candidate[best];
+        candidate[best] = candidate[--candidates];
+    }
+
+    for (int d = 0; d < candidates; d++)
+        free(candidate[d].vertices);
+    free(candidate);
+    free(banned);
+    return found;
+}
+
+void destroy_yen_paths(struct YenPath *paths, int n)
+{
+    for (int p = 0; p < n; p++)
+        free(paths[p].vertices);
+}
+
+#endif